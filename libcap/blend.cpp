@@ -0,0 +1,153 @@
+#include "libcap/blend.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+namespace blend
+{
+    static inline void pixel_over(uint8_t *dst, const uint32_t c)
+    {
+        const uint8_t r = (c >> 0) & 0xff;
+        const uint8_t g = (c >> 8) & 0xff;
+        const uint8_t b = (c >> 16) & 0xff;
+        const uint8_t a = (c >> 24) & 0xff;
+
+        switch (a) {
+        case 0: break;
+        case 255:
+            dst[0] = r;
+            dst[1] = g;
+            dst[2] = b;
+            break;
+        default:
+            dst[0] = r + (dst[0] * (255 - a) + 127) / 255;
+            dst[1] = g + (dst[1] * (255 - a) + 127) / 255;
+            dst[2] = b + (dst[2] * (255 - a) + 127) / 255;
+            break;
+        }
+    }
+
+    void argb_over_c(uint8_t *dst, const int dst_linesize, const int pbytes, const uint32_t *src,
+                     const int src_stride, const int w, const int h)
+    {
+        for (int i = 0; i < h; ++i, dst += dst_linesize, src += src_stride) {
+            auto dline = dst;
+            for (int j = 0; j < w; ++j, dline += pbytes) {
+                pixel_over(dline, src[j]);
+            }
+        }
+    }
+
+#if defined(__x86_64__) || defined(_M_X64)
+    // (x + 127) / 255 == ((x + 127) * 0x8081) >> 23, for all x in [0, 255 * 255]
+    static inline __m128i div255_sse2(const __m128i x)
+    {
+        const auto t = _mm_add_epi16(x, _mm_set1_epi16(127));
+        return _mm_srli_epi16(_mm_mulhi_epu16(t, _mm_set1_epi16(static_cast<short>(0x8081))), 7);
+    }
+
+    // 4 pixels
+    static inline __m128i over_sse2(const __m128i s, const __m128i d)
+    {
+        const auto zero  = _mm_setzero_si128();
+        const auto amask = _mm_set1_epi32(static_cast<int>(0xff000000));
+
+        // 255 - a, broadcasted to the bytes of the pixel
+        auto a = _mm_srli_epi32(s, 24);
+        a      = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+        a      = _mm_or_si128(a, _mm_slli_epi32(a, 16));
+        a      = _mm_xor_si128(a, _mm_set1_epi8(-1));
+
+        const auto lo =
+            div255_sse2(_mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(a, zero)));
+        const auto hi =
+            div255_sse2(_mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(a, zero)));
+
+        // wraps around as the scalar version does if the source is not premultiplied
+        const auto r = _mm_add_epi8(s, _mm_packus_epi16(lo, hi));
+
+        // keep the 4th byte, and the whole pixel if a == 0
+        const auto keep = _mm_or_si128(amask, _mm_cmpeq_epi32(_mm_and_si128(s, amask), zero));
+        return _mm_or_si128(_mm_and_si128(keep, d), _mm_andnot_si128(keep, r));
+    }
+
+    void argb_over_sse2(uint8_t *dst, const int dst_linesize, const uint32_t *src, const int src_stride,
+                        const int w, const int h)
+    {
+        for (int i = 0; i < h; ++i, dst += dst_linesize, src += src_stride) {
+            int j = 0;
+            for (; j + 4 <= w; j += 4) {
+                const auto s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + j));
+                const auto d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + j * 4));
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + j * 4), over_sse2(s, d));
+            }
+
+            for (; j < w; ++j) pixel_over(dst + j * 4, src[j]);
+        }
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+    bool has_avx2() { return __builtin_cpu_supports("avx2"); }
+
+    __attribute__((target("avx2"))) static inline __m256i div255_avx2(const __m256i x)
+    {
+        const auto t = _mm256_add_epi16(x, _mm256_set1_epi16(127));
+        return _mm256_srli_epi16(_mm256_mulhi_epu16(t, _mm256_set1_epi16(static_cast<short>(0x8081))), 7);
+    }
+
+    // 8 pixels, the unpacking and packing work in 128-bit lanes, so the pixels stay in order
+    __attribute__((target("avx2"))) static inline __m256i over_avx2(const __m256i s, const __m256i d)
+    {
+        const auto zero  = _mm256_setzero_si256();
+        const auto amask = _mm256_set1_epi32(static_cast<int>(0xff000000));
+
+        auto a = _mm256_srli_epi32(s, 24);
+        a      = _mm256_or_si256(a, _mm256_slli_epi32(a, 8));
+        a      = _mm256_or_si256(a, _mm256_slli_epi32(a, 16));
+        a      = _mm256_xor_si256(a, _mm256_set1_epi8(-1));
+
+        const auto lo = div255_avx2(
+            _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), _mm256_unpacklo_epi8(a, zero)));
+        const auto hi = div255_avx2(
+            _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), _mm256_unpackhi_epi8(a, zero)));
+
+        const auto r = _mm256_add_epi8(s, _mm256_packus_epi16(lo, hi));
+
+        const auto keep = _mm256_or_si256(amask, _mm256_cmpeq_epi32(_mm256_and_si256(s, amask), zero));
+        return _mm256_or_si256(_mm256_and_si256(keep, d), _mm256_andnot_si256(keep, r));
+    }
+
+    __attribute__((target("avx2"))) void argb_over_avx2(uint8_t *dst, const int dst_linesize,
+                                                        const uint32_t *src, const int src_stride,
+                                                        const int w, const int h)
+    {
+        for (int i = 0; i < h; ++i, dst += dst_linesize, src += src_stride) {
+            int j = 0;
+            for (; j + 8 <= w; j += 8) {
+                const auto s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + j));
+                const auto d = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + j * 4));
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + j * 4), over_avx2(s, d));
+            }
+
+            for (; j < w; ++j) pixel_over(dst + j * 4, src[j]);
+        }
+    }
+#endif
+#endif
+
+    void argb_over(uint8_t *dst, const int dst_linesize, const int pbytes, const uint32_t *src,
+                   const int src_stride, const int w, const int h)
+    {
+#if defined(__x86_64__) || defined(_M_X64)
+        if (pbytes == 4) {
+#if defined(__GNUC__) || defined(__clang__)
+            static const bool avx2 = has_avx2();
+            if (avx2) return argb_over_avx2(dst, dst_linesize, src, src_stride, w, h);
+#endif
+            return argb_over_sse2(dst, dst_linesize, src, src_stride, w, h);
+        }
+#endif
+        argb_over_c(dst, dst_linesize, pbytes, src, src_stride, w, h);
+    }
+} // namespace blend
@@ -0,0 +1,329 @@
+#include "libcap/chunked-encoder.h"
+
+#include "libcap/dispatcher.h"
+#include "libcap/encoder.h"
+#include "libcap/media-reader.h"
+#include "libcap/priority.h"
+#include "logging.h"
+
+#include <filesystem>
+#include <fmt/chrono.h>
+#include <probe/defer.h>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+// shorter segments hurt the rate control and the compression
+static constexpr auto MIN_SEGMENT_DURATION = 30s;
+
+ChunkedEncoder::ChunkedEncoder(const int jobs)
+    : jobs_(std::max(jobs, 1))
+{}
+
+double ChunkedEncoder::progress() const
+{
+    if (duration_ <= 0ns) return 0;
+
+    int64_t encoded = 0;
+    for (const auto& segment : segments_) {
+        encoded += segment->position.load();
+    }
+
+    return std::clamp(static_cast<double>(encoded) / static_cast<double>(duration_.count()), 0.0, 1.0);
+}
+
+int ChunkedEncoder::split(const std::string& input)
+{
+    AVFormatContext *fmt_ctx = nullptr;
+    if (avformat_open_input(&fmt_ctx, input.c_str(), nullptr, nullptr) < 0) return av::NOT_FOUND;
+    defer(avformat_close_input(&fmt_ctx));
+
+    if (avformat_find_stream_info(fmt_ctx, nullptr) < 0) return -1;
+
+    const int index = av_find_best_stream(fmt_ctx, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+    if (index < 0 || fmt_ctx->duration == AV_NOPTS_VALUE) return av::UNSUPPORTED;
+
+    const auto stream = fmt_ctx->streams[index];
+    const auto start  = fmt_ctx->start_time == AV_NOPTS_VALUE
+                            ? 0ns
+                            : av::clock::ns(fmt_ctx->start_time, { 1, AV_TIME_BASE });
+
+    duration_ = av::clock::ns(fmt_ctx->duration, { 1, AV_TIME_BASE });
+
+    // 2 segments for each job to balance the load
+    const auto nb_segments = std::clamp<int64_t>(duration_ / MIN_SEGMENT_DURATION, 1, jobs_ * 2);
+
+    std::vector<std::chrono::nanoseconds> points{};
+    for (int64_t i = 1; i < nb_segments; ++i) {
+        auto point = start + duration_ * i / nb_segments;
+
+        // the key frame before the even split, if the demuxer has an index
+        const auto ts = av::clock::to(point, stream->time_base);
+        if (const auto entry = avformat_index_get_entry_from_timestamp(stream, ts, AVSEEK_FLAG_BACKWARD);
+            entry && (entry->flags & AVINDEX_KEYFRAME)) {
+            point = av::clock::ns(entry->timestamp, stream->time_base);
+        }
+
+        if (points.empty() || point - points.back() >= MIN_SEGMENT_DURATION / 2) points.push_back(point);
+    }
+
+    const auto stem = std::filesystem::path{ input }.replace_extension().string();
+    for (size_t i = 0; i <= points.size(); ++i) {
+        auto segment      = std::make_unique<segment_t>();
+        segment->ss       = (i == 0) ? av::clock::min : points[i - 1];
+        segment->to       = (i == points.size()) ? av::clock::max : points[i];
+        segment->filename = fmt::format("{}.part{}.nut", stem, i);
+        segments_.emplace_back(std::move(segment));
+    }
+
+    logi("[   CHUNKED] {:%T}, {} segments, {} jobs", duration_, segments_.size(), jobs_);
+    return 0;
+}
+
+int ChunkedEncoder::encode(const std::string& input, const AVMediaType type, segment_t& segment) const
+{
+    // destroyed in the reverse order, the dispatcher first
+    MediaReader reader{};
+    Encoder     encoder{};
+    Dispatcher  dispatcher{};
+
+    reader.enable(type == AVMEDIA_TYPE_VIDEO ? AVMEDIA_TYPE_AUDIO : AVMEDIA_TYPE_VIDEO, false);
+
+    std::map<std::string, std::string> range{};
+    if (segment.ss != av::clock::min) range["ss"] = fmt::format("{:.6f}", segment.ss.count() / 1e9);
+    if (segment.to != av::clock::max) range["to"] = fmt::format("{:.6f}", segment.to.count() / 1e9);
+    if (background_) range["background"] = "true";
+
+    if (reader.open(input, range) < 0) return -1;
+
+    dispatcher.set_offline(true);
+    dispatcher.set_background(background_);
+    if (dispatcher.add_input(&reader) < 0) return -1;
+
+    encoder.vfmt.pix_fmt   = vfmt_.pix_fmt;
+    encoder.vfmt.color     = vfmt_.color;
+    encoder.vfmt.framerate = vfmt_.framerate;
+    encoder.afmt           = afmt_;
+
+    dispatcher.set_output(&encoder);
+
+    if (dispatcher.initialize({}, {}) < 0) return -1;
+
+    const auto threads = std::max<int>(std::thread::hardware_concurrency() / jobs_, 1);
+
+    auto options       = options_;
+    options["offline"] = "true";
+    options["threads"] = std::to_string(threads);
+    if (encoder.open(segment.filename, options) < 0) return -1;
+
+    if (dispatcher.start() < 0) return -1;
+
+    const auto start = std::max(segment.ss, reader.start_time());
+    while (!encoder.eof() && dispatcher.running() && !cancelled_) {
+        std::this_thread::sleep_for(100ms);
+
+        if (type == AVMEDIA_TYPE_VIDEO) {
+            segment.position = std::max(dispatcher.escaped() - std::max(start, 0ns), 0ns).count();
+        }
+    }
+
+    const auto ok = encoder.eof() && !cancelled_;
+
+    dispatcher.stop();
+
+    return ok ? 0 : -1;
+}
+
+int ChunkedEncoder::concat(const std::string& output, const std::string& audio) const
+{
+    struct input_t
+    {
+        ~input_t() { avformat_close_input(&ctx); }
+
+        int open(const std::string& filename, const AVMediaType type)
+        {
+            avformat_close_input(&ctx);
+
+            if (avformat_open_input(&ctx, filename.c_str(), nullptr, nullptr) < 0) return -1;
+            if (avformat_find_stream_info(ctx, nullptr) < 0) return -1;
+
+            index = av_find_best_stream(ctx, type, -1, -1, nullptr, 0);
+            return index;
+        }
+
+        [[nodiscard]] AVStream *stream() const { return ctx->streams[index]; }
+
+        AVFormatContext *ctx{};
+        int              index{ -1 };
+    };
+
+    input_t vinput{};
+    input_t ainput{};
+    size_t  part = 0;
+
+    if (vinput.open(segments_[0]->filename, AVMEDIA_TYPE_VIDEO) < 0) return -1;
+    if (!audio.empty() && ainput.open(audio, AVMEDIA_TYPE_AUDIO) < 0) return -1;
+
+    AVFormatContext *fmt_ctx = nullptr;
+    if (avformat_alloc_output_context2(&fmt_ctx, nullptr, nullptr, output.c_str()) < 0) return av::INVALID;
+    defer(avio_closep(&fmt_ctx->pb); avformat_free_context(fmt_ctx));
+
+    // the codec parameters of the first segment
+    std::vector<std::pair<input_t *, AVStream *>> streams{};
+    for (const auto input : { &vinput, &ainput }) {
+        if (!input->ctx) continue;
+
+        const auto stream = avformat_new_stream(fmt_ctx, nullptr);
+        if (!stream || avcodec_parameters_copy(stream->codecpar, input->stream()->codecpar) < 0)
+            return av::NOMEM;
+
+        stream->codecpar->codec_tag = 0;
+        stream->time_base           = input->stream()->time_base;
+        streams.emplace_back(input, stream);
+    }
+
+    if (avio_open(&fmt_ctx->pb, output.c_str(), AVIO_FLAG_WRITE) < 0) {
+        loge("[   CHUNKED] can not open the output file: {}", output);
+        return av::DENIED;
+    }
+
+    if (avformat_write_header(fmt_ctx, nullptr) < 0) return -1;
+
+    // the video packets of all segments in order, the timestamps are continuous
+    const auto read_video = [&](av::packet& packet) {
+        while (true) {
+            const int ret = av_read_frame(vinput.ctx, packet.put());
+            if (ret >= 0) {
+                if (packet->stream_index == vinput.index) return true;
+                continue;
+            }
+
+            if (++part >= segments_.size()) return false;
+            if (vinput.open(segments_[part]->filename, AVMEDIA_TYPE_VIDEO) < 0) return false;
+        }
+    };
+
+    const auto read_audio = [&](av::packet& packet) {
+        while (ainput.ctx && av_read_frame(ainput.ctx, packet.put()) >= 0) {
+            if (packet->stream_index == ainput.index) return true;
+        }
+        return false;
+    };
+
+    av::packet vpacket{};
+    av::packet apacket{};
+    auto       has_video = read_video(vpacket);
+    auto       has_audio = read_audio(apacket);
+
+    while ((has_video || has_audio) && !cancelled_) {
+        const auto vtb   = vinput.stream()->time_base;
+        const auto video = has_video && (!has_audio || av_compare_ts(vpacket->dts, vtb, apacket->dts,
+                                                                     ainput.stream()->time_base) <= 0);
+
+        auto&      packet = video ? vpacket : apacket;
+        const auto itb    = video ? vtb : ainput.stream()->time_base;
+        const auto stream = video ? streams[0].second : streams.back().second;
+
+        av_packet_rescale_ts(packet.get(), itb, stream->time_base);
+        packet->stream_index = stream->index;
+        packet->pos          = -1;
+
+        if (const int ret = av_interleaved_write_frame(fmt_ctx, packet.get()); ret < 0) {
+            loge("[   CHUNKED] failed to write the packet: {}", av::ff_errstr(ret));
+            return ret;
+        }
+
+        if (video)
+            has_video = read_video(vpacket);
+        else
+            has_audio = read_audio(apacket);
+    }
+
+    if (av_write_trailer(fmt_ctx) < 0) return -1;
+
+    return cancelled_ ? -1 : 0;
+}
+
+int ChunkedEncoder::run(const std::string& input, const std::string& output, const av::vformat_t& vfmt,
+                        const av::aformat_t& afmt, std::map<std::string, std::string> options)
+{
+    const auto t0 = av::clock::ns();
+
+    vfmt_    = vfmt;
+    afmt_    = afmt;
+    options_ = std::move(options);
+
+    background_ = options_.contains("background") &&
+                  (options_.at("background") == "1" || options_.at("background") == "true");
+
+    if (split(input) < 0) {
+        loge("[   CHUNKED] failed to split the input: {}", input);
+        return -1;
+    }
+
+    // the audio in one piece, if any
+    segment_t asegment{};
+    {
+        MediaReader probe{};
+        probe.enable(AVMEDIA_TYPE_VIDEO, false);
+        if (probe.open(input, {}) >= 0 && probe.has(AVMEDIA_TYPE_AUDIO)) {
+            asegment.filename = std::filesystem::path{ input }.replace_extension().string() + ".audio.nut";
+        }
+    }
+
+    std::atomic<bool>   failed{};
+    std::atomic<size_t> next{};
+    std::atomic<int>    remaining{ jobs_ + (asegment.filename.empty() ? 0 : 1) };
+
+    {
+        std::vector<std::jthread> workers{};
+        for (int i = 0; i < jobs_; ++i) {
+            workers.emplace_back([&, i] {
+                probe::thread::set_name(fmt::format("CHUNKED-{}", i));
+                if (background_) av::lower_thread_priority();
+
+                for (auto k = next++; k < segments_.size() && !failed && !cancelled_; k = next++) {
+                    if (encode(input, AVMEDIA_TYPE_VIDEO, *segments_[k]) < 0) {
+                        loge("[   CHUNKED] failed to encode the segment #{}", k);
+                        failed = true;
+                    }
+                }
+
+                remaining--;
+            });
+        }
+
+        if (!asegment.filename.empty()) {
+            workers.emplace_back([&] {
+                probe::thread::set_name("CHUNKED-A");
+                if (background_) av::lower_thread_priority();
+
+                if (encode(input, AVMEDIA_TYPE_AUDIO, asegment) < 0) {
+                    loge("[   CHUNKED] failed to encode the audio");
+                    failed = true;
+                }
+
+                remaining--;
+            });
+        }
+
+        while (remaining > 0) {
+            std::this_thread::sleep_for(100ms);
+            onprogress(progress());
+        }
+    }
+
+    auto ret = (failed || cancelled_) ? -1 : concat(output, asegment.filename);
+
+    // the temporary files
+    std::error_code ec{};
+    for (const auto& segment : segments_) {
+        std::filesystem::remove(segment->filename, ec);
+    }
+    if (!asegment.filename.empty()) std::filesystem::remove(asegment.filename, ec);
+
+    logi("[   CHUNKED] {}, {:%T} in {:%T}", ret < 0 ? "FAILED" : "DONE", duration_, av::clock::ns() - t0);
+
+    return ret;
+}
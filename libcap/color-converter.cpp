@@ -0,0 +1,386 @@
+#include "libcap/color-converter.h"
+
+#include "logging.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// of the linesizes of the output frames
+static constexpr int FRAME_ALIGN = 32;
+
+using coeffs_t = ColorConverter::coeffs_t;
+
+static coeffs_t make_coeffs(const AVColorSpace space, const AVColorRange range)
+{
+    const double kr = (space == AVCOL_SPC_BT709) ? 0.2126 : 0.299;
+    const double kb = (space == AVCOL_SPC_BT709) ? 0.0722 : 0.114;
+
+    const bool   full = (range == AVCOL_RANGE_JPEG);
+    const double ys   = full ? 1.0 : 219.0 / 255.0;
+    const double cs   = full ? 1.0 : 224.0 / 255.0;
+
+    const auto q14 = [](const double v) { return static_cast<int16_t>(std::lround(v * (1 << 14))); };
+
+    coeffs_t c{};
+
+    // the green ones absorb the rounding errors: white stays white and gray has no chroma
+    c.y[0] = q14(kr * ys);
+    c.y[2] = q14(kb * ys);
+    c.y[1] = static_cast<int16_t>(q14(ys) - c.y[0] - c.y[2]);
+
+    c.u[0] = q14(-kr / (2 * (1 - kb)) * cs);
+    c.u[2] = q14(0.5 * cs);
+    c.u[1] = static_cast<int16_t>(-c.u[0] - c.u[2]);
+
+    c.v[0] = q14(0.5 * cs);
+    c.v[2] = q14(-kb / (2 * (1 - kr)) * cs);
+    c.v[1] = static_cast<int16_t>(-c.v[0] - c.v[2]);
+
+    c.yoff = ((full ? 0 : 16) << 14) + (1 << 13);
+    c.coff = (128 << 16) + (1 << 15);
+
+    return c;
+}
+
+static inline uint8_t clip_u8(const int v) { return static_cast<uint8_t>(std::clamp(v, 0, 255)); }
+
+// from x to the end of the row pair, 2 pixels at a time, the last column is repeated if the width is odd
+static void rows_c(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                   int x, const int w, const int shifts[3], const coeffs_t& c)
+{
+    const uint8_t *srcs[2] = { s0, s1 };
+    uint8_t       *dsts[2] = { y0, y1 };
+
+    for (; x < w; x += 2) {
+        int sr = 0, sg = 0, sb = 0;
+
+        for (int k = 0; k < 2; ++k) {
+            for (const int i : { x, std::min(x + 1, w - 1) }) {
+                uint32_t px{};
+                std::memcpy(&px, srcs[k] + i * 4, 4);
+
+                const int r = (px >> shifts[0]) & 0xff;
+                const int g = (px >> shifts[1]) & 0xff;
+                const int b = (px >> shifts[2]) & 0xff;
+
+                dsts[k][i] = clip_u8((c.y[0] * r + c.y[1] * g + c.y[2] * b + c.yoff) >> 14);
+
+                sr += r;
+                sg += g;
+                sb += b;
+            }
+        }
+
+        const auto cu = clip_u8((c.u[0] * sr + c.u[1] * sg + c.u[2] * sb + c.coff) >> 16);
+        const auto cv = clip_u8((c.v[0] * sr + c.v[1] * sg + c.v[2] * sb + c.coff) >> 16);
+
+        if (v) {
+            u[x / 2] = cu;
+            v[x / 2] = cv;
+        }
+        else {
+            u[x]     = cu;
+            u[x + 1] = cv;
+        }
+    }
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+// r, g, b of 8 pixels, in 16-bit lanes
+static inline void unpack_sse2(const uint8_t *src, const __m128i rs, const __m128i gs, const __m128i bs,
+                               __m128i& r, __m128i& g, __m128i& b)
+{
+    const auto mask = _mm_set1_epi32(0xff);
+    const auto p0   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src));
+    const auto p1   = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + 16));
+
+    const auto component = [&](const __m128i shift) {
+        return _mm_packs_epi32(_mm_and_si128(_mm_srl_epi32(p0, shift), mask),
+                               _mm_and_si128(_mm_srl_epi32(p1, shift), mask));
+    };
+
+    r = component(rs);
+    g = component(gs);
+    b = component(bs);
+}
+
+// (c0 * x + c1 * y + c2 * z + off) >> S of 8 lanes, saturated to 16-bit
+template<int S>
+static inline __m128i dot_sse2(const __m128i x, const __m128i y, const __m128i z, const __m128i c01,
+                               const __m128i c2, const __m128i off)
+{
+    const auto zero = _mm_setzero_si128();
+
+    auto lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(x, y), c01),
+                            _mm_madd_epi16(_mm_unpacklo_epi16(z, zero), c2));
+    auto hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(x, y), c01),
+                            _mm_madd_epi16(_mm_unpackhi_epi16(z, zero), c2));
+
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, off), S);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, off), S);
+
+    return _mm_packs_epi32(lo, hi);
+}
+
+static inline __m128i pair_sse2(const int16_t c0, const int16_t c1)
+{
+    return _mm_set1_epi32(static_cast<int>(static_cast<uint16_t>(c0) |
+                                           (static_cast<uint32_t>(static_cast<uint16_t>(c1)) << 16)));
+}
+
+// 16 pixels at a time, returns the number of the converted pixels, bit-exact with rows_c()
+static int rows_sse2(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+                     const int w, const int shifts[3], const coeffs_t& c)
+{
+    const auto rs = _mm_cvtsi32_si128(shifts[0]);
+    const auto gs = _mm_cvtsi32_si128(shifts[1]);
+    const auto bs = _mm_cvtsi32_si128(shifts[2]);
+
+    const auto yrg  = pair_sse2(c.y[0], c.y[1]);
+    const auto yb   = pair_sse2(c.y[2], 0);
+    const auto urg  = pair_sse2(c.u[0], c.u[1]);
+    const auto ub   = pair_sse2(c.u[2], 0);
+    const auto vrg  = pair_sse2(c.v[0], c.v[1]);
+    const auto vb   = pair_sse2(c.v[2], 0);
+    const auto yoff = _mm_set1_epi32(c.yoff);
+    const auto coff = _mm_set1_epi32(c.coff);
+    const auto ones = _mm_set1_epi16(1);
+
+    int x = 0;
+    for (; x + 16 <= w; x += 16) {
+        // [0, 1]: row 0, [2, 3]: row 1
+        __m128i r[4], g[4], b[4];
+        unpack_sse2(s0 + x * 4, rs, gs, bs, r[0], g[0], b[0]);
+        unpack_sse2(s0 + x * 4 + 32, rs, gs, bs, r[1], g[1], b[1]);
+        unpack_sse2(s1 + x * 4, rs, gs, bs, r[2], g[2], b[2]);
+        unpack_sse2(s1 + x * 4 + 32, rs, gs, bs, r[3], g[3], b[3]);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(y0 + x),
+                         _mm_packus_epi16(dot_sse2<14>(r[0], g[0], b[0], yrg, yb, yoff),
+                                          dot_sse2<14>(r[1], g[1], b[1], yrg, yb, yoff)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(y1 + x),
+                         _mm_packus_epi16(dot_sse2<14>(r[2], g[2], b[2], yrg, yb, yoff),
+                                          dot_sse2<14>(r[3], g[3], b[3], yrg, yb, yoff)));
+
+        // the sums of 2x2 pixels, 8 chroma samples
+        const auto sum = [&](const __m128i *p) {
+            return _mm_packs_epi32(_mm_madd_epi16(_mm_add_epi16(p[0], p[2]), ones),
+                                   _mm_madd_epi16(_mm_add_epi16(p[1], p[3]), ones));
+        };
+
+        const auto sr = sum(r);
+        const auto sg = sum(g);
+        const auto sb = sum(b);
+
+        const auto cu = dot_sse2<16>(sr, sg, sb, urg, ub, coff);
+        const auto cv = dot_sse2<16>(sr, sg, sb, vrg, vb, coff);
+
+        if (v) {
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(u + x / 2), _mm_packus_epi16(cu, cu));
+            _mm_storel_epi64(reinterpret_cast<__m128i *>(v + x / 2), _mm_packus_epi16(cv, cv));
+        }
+        else {
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(u + x),
+                             _mm_unpacklo_epi8(_mm_packus_epi16(cu, cu), _mm_packus_epi16(cv, cv)));
+        }
+    }
+
+    return x;
+}
+#endif
+
+static bool is_rgb32(const AVPixelFormat fmt)
+{
+    const auto desc = av_pix_fmt_desc_get(fmt);
+    if (!desc || desc->nb_components < 3 || !(desc->flags & AV_PIX_FMT_FLAG_RGB)) return false;
+
+    if (desc->flags & (AV_PIX_FMT_FLAG_PLANAR | AV_PIX_FMT_FLAG_PAL | AV_PIX_FMT_FLAG_HWACCEL |
+                       AV_PIX_FMT_FLAG_BITSTREAM | AV_PIX_FMT_FLAG_FLOAT))
+        return false;
+
+    for (int i = 0; i < 3; ++i) {
+        if (desc->comp[i].step != 4 || desc->comp[i].depth != 8 || desc->comp[i].shift != 0) return false;
+    }
+
+    return true;
+}
+
+bool ColorConverter::supports(const av::vformat_t& in, const av::vformat_t& out)
+{
+    if (in.hwaccel != AV_HWDEVICE_TYPE_NONE || out.hwaccel != AV_HWDEVICE_TYPE_NONE) return false;
+
+    if (!is_rgb32(in.pix_fmt) || in.width <= 0 || in.height <= 0) return false;
+
+    if (out.pix_fmt != AV_PIX_FMT_NV12 && out.pix_fmt != AV_PIX_FMT_YUV420P) return false;
+
+    // no scaling
+    if ((out.width > 0 && out.width != in.width) || (out.height > 0 && out.height != in.height))
+        return false;
+
+    switch (out.color.space) {
+    case AVCOL_SPC_UNSPECIFIED:
+    case AVCOL_SPC_BT470BG:
+    case AVCOL_SPC_SMPTE170M:
+    case AVCOL_SPC_BT709:       return true;
+    default:                    return false;
+    }
+}
+
+int ColorConverter::open(const av::vformat_t& in, const av::vformat_t& out, const int threads)
+{
+    if (!supports(in, out)) return av::UNSUPPORTED;
+
+    close();
+
+    const auto desc = av_pix_fmt_desc_get(in.pix_fmt);
+    for (int i = 0; i < 3; ++i) {
+        shifts_[i] = desc->comp[i].offset * 8;
+    }
+
+    ifmt_ = in;
+
+    ofmt_         = in;
+    ofmt_.pix_fmt = out.pix_fmt;
+    ofmt_.color   = out.color;
+    // the defaults of libswscale
+    if (ofmt_.color.space == AVCOL_SPC_UNSPECIFIED) ofmt_.color.space = AVCOL_SPC_BT470BG;
+    if (ofmt_.color.range == AVCOL_RANGE_UNSPECIFIED) ofmt_.color.range = AVCOL_RANGE_MPEG;
+
+    coeffs_ = make_coeffs(ofmt_.color.space, ofmt_.color.range);
+
+    const auto size = av_image_get_buffer_size(ofmt_.pix_fmt, ofmt_.width, ofmt_.height, FRAME_ALIGN);
+    if (size < 0 || !(pool_ = av_buffer_pool_init(static_cast<size_t>(size), av_buffer_alloc))) {
+        loge("[ CONVERTER] failed to init buffer pool");
+        return av::NOMEM;
+    }
+
+    // at least 8 row pairs per slice
+    nb_slices_ = std::clamp(threads, 1, std::max(1, (ofmt_.height + 1) / 2 / 8));
+
+    jobs_    = 0;
+    pending_ = 0;
+    running_ = true;
+    for (int i = 1; i < nb_slices_; ++i) {
+        workers_.emplace_back([this, i] { worker_fn(i); });
+    }
+
+    logi("[ CONVERTER] '{}' -> '{}', slices = {}", av::to_string(ifmt_), av::to_string(ofmt_), nb_slices_);
+
+    return 0;
+}
+
+void ColorConverter::worker_fn(const int slice)
+{
+    probe::thread::set_name(fmt::format("CONVERTER-{}", slice));
+
+    uint64_t jobs = 0;
+    while (true) {
+        jobs_.wait(jobs, std::memory_order_acquire);
+        jobs = jobs_.load(std::memory_order_acquire);
+
+        if (!running_) break;
+
+        convert_slice(src_, dst_, slice);
+
+        if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) pending_.notify_one();
+    }
+}
+
+void ColorConverter::convert_slice(const AVFrame *in, AVFrame *out, const int slice) const
+{
+    const int h     = ofmt_.height;
+    const int w     = ofmt_.width;
+    const int pairs = (h + 1) / 2;
+    const int begin = pairs * slice / nb_slices_;
+    const int end   = pairs * (slice + 1) / nb_slices_;
+
+    for (int p = begin; p < end; ++p) {
+        // the last row is repeated if the height is odd
+        const int r0 = 2 * p;
+        const int r1 = std::min(r0 + 1, h - 1);
+
+        const auto s0 = in->data[0] + r0 * in->linesize[0];
+        const auto s1 = in->data[0] + r1 * in->linesize[0];
+        const auto y0 = out->data[0] + r0 * out->linesize[0];
+        const auto y1 = out->data[0] + r1 * out->linesize[0];
+        const auto u  = out->data[1] + p * out->linesize[1];
+        const auto v  = (ofmt_.pix_fmt == AV_PIX_FMT_NV12) ? nullptr : out->data[2] + p * out->linesize[2];
+
+        int x = 0;
+#if defined(__x86_64__) || defined(_M_X64)
+        x = rows_sse2(s0, s1, y0, y1, u, v, w, shifts_, coeffs_);
+#endif
+        rows_c(s0, s1, y0, y1, u, v, x, w, shifts_, coeffs_);
+    }
+}
+
+int ColorConverter::convert(const av::frame& in, av::frame& out)
+{
+    if (!pool_ || !in) return av::INVALID;
+
+    if (in->format != ifmt_.pix_fmt || in->width != ifmt_.width || in->height != ifmt_.height) {
+        loge("[ CONVERTER] unexpected frame: {}x{}, {}", in->width, in->height,
+             av::to_string(static_cast<AVPixelFormat>(in->format)));
+        return av::INVALID;
+    }
+
+    out.put();
+    if (out->buf[0] = av_buffer_pool_get(pool_); !out->buf[0]) return av::NOMEM;
+
+    av_image_fill_arrays(out->data, out->linesize, out->buf[0]->data, ofmt_.pix_fmt, ofmt_.width,
+                         ofmt_.height, FRAME_ALIGN);
+
+    out->width  = ofmt_.width;
+    out->height = ofmt_.height;
+    out->format = ofmt_.pix_fmt;
+
+    // pts, side data, etc.
+    av_frame_copy_props(out.get(), in.get());
+
+    out->color_range     = ofmt_.color.range;
+    out->colorspace      = ofmt_.color.space;
+    out->color_primaries = ofmt_.color.primaries;
+    out->color_trc       = ofmt_.color.transfer;
+
+    if (nb_slices_ > 1) {
+        src_ = in.get();
+        dst_ = out.get();
+
+        pending_.store(nb_slices_ - 1, std::memory_order_relaxed);
+        jobs_.fetch_add(1, std::memory_order_release);
+        jobs_.notify_all();
+    }
+
+    // the first slice on the calling thread
+    convert_slice(in.get(), out.get(), 0);
+
+    // wait for the other slices
+    for (auto n = pending_.load(std::memory_order_acquire); n > 0;
+         n      = pending_.load(std::memory_order_acquire)) {
+        pending_.wait(n, std::memory_order_acquire);
+    }
+
+    return 0;
+}
+
+void ColorConverter::close()
+{
+    if (running_) {
+        running_ = false;
+        jobs_.fetch_add(1, std::memory_order_release);
+        jobs_.notify_all();
+    }
+    workers_.clear();
+
+    av_buffer_pool_uninit(&pool_);
+}
@@ -3,6 +3,7 @@
 #include "libcap/clock.h"
 #include "libcap/devices.h"
 #include "libcap/filter.h"
+#include "libcap/priority.h"
 #include "logging.h"
 
 #include <fmt/chrono.h>
@@ -18,17 +19,23 @@ extern "C" {
 int Dispatcher::add_input(Producer<av::frame> *producer)
 {
     if (!producer) return av::NULLPTR;
-    if (!producer->is_realtime()) return av::INVALID;
+    if (producer->is_realtime() == offline_) {
+        loge("[DISPATCHER] {} is {}realtime, not supported in {} mode", producer->name(),
+             producer->is_realtime() ? "" : "not ", offline_ ? "offline" : "realtime");
+        return av::INVALID;
+    }
 
-    producers_.insert(producer);
+    if (producers_.insert(producer).second && producer->has(AVMEDIA_TYPE_AUDIO)) {
+        audio_inputs_.push_back(producer);
+    }
 
     if (producer->has(AVMEDIA_TYPE_AUDIO)) actx_.enabled = true;
     if (producer->has(AVMEDIA_TYPE_VIDEO)) vctx_.enabled = true;
 
     producer->onarrived = [=, this](const av::frame& frame, auto type) {
         switch (type) {
-        case AVMEDIA_TYPE_AUDIO: actx_.queue.wait_and_push({ frame, producer }); break;
-        case AVMEDIA_TYPE_VIDEO: vctx_.queue.wait_and_push({ frame, producer }); break;
+        case AVMEDIA_TYPE_AUDIO:
+        case AVMEDIA_TYPE_VIDEO: enqueue(type, frame, producer); break;
         default:                 break;
         }
     };
@@ -36,36 +43,216 @@ int Dispatcher::add_input(Producer<av::frame> *producer)
     return 0;
 }
 
+// returns false if a frame has been dropped
+// elastic only, the queue grows from capacity up to limit before the oldest frame is evicted, and shrinks
+// back to capacity once it has been drained, so that a hiccup of the consumer does not keep the memory
+// and the latency of a full queue
+template<class T>
+static bool push_or_drop(safe_queue<T>& queue, T&& value, const av::backpressure_t bp,
+                         const size_t capacity, const size_t limit)
+{
+    switch (bp) {
+    case av::backpressure_t::elastic:
+        if (queue.capacity() > capacity && queue.size() <= capacity / 2) queue.reserve(capacity);
+
+        while (!queue.push(std::move(value))) {
+            if (queue.stopped()) return true;
+
+            const auto current = queue.capacity();
+            if (current >= limit) return !queue.evict_and_push(std::move(value));
+
+            queue.reserve(std::min(current * 2, limit));
+        }
+        return true;
+
+    case av::backpressure_t::drop_oldest: return !queue.evict_and_push(std::move(value));
+
+    case av::backpressure_t::drop_newest: return queue.push(std::move(value)) || queue.stopped();
+
+    case av::backpressure_t::block:
+    default:                              queue.wait_and_push(std::move(value)); return true;
+    }
+}
+
+void Dispatcher::enqueue(const AVMediaType mt, const av::frame& frame, Producer<av::frame> *producer)
+{
+    auto& ctx = (mt == AVMEDIA_TYPE_AUDIO) ? actx_ : vctx_;
+
+    if (!push_or_drop(ctx.queue, { frame, producer }, ctx.backpressure, ctx.capacity, ctx.limit)) {
+        const auto dropped = ++ctx.dropped;
+
+        if (ctx.backpressure == av::backpressure_t::elastic)
+            logw("[{}] queue reached its limit {}, drop the oldest frame, dropped = {}", av::to_char(mt),
+                 ctx.limit, dropped);
+        else
+            logd("[{}] queue is full, drop a frame ({})", av::to_char(mt), av::to_string(ctx.backpressure));
+    }
+}
+
+int Dispatcher::set_offline(const bool offline)
+{
+    if (ready_ || !producers_.empty()) return av::ALREADY;
+
+    offline_ = offline;
+
+    // never drop, block the producers instead
+    if (offline_) {
+        vctx_.backpressure = av::backpressure_t::block;
+        actx_.backpressure = av::backpressure_t::block;
+    }
+
+    logi("[DISPATCHER] offline = {}", offline_);
+    return 0;
+}
+
+int Dispatcher::set_separate_audio_tracks(const bool separate)
+{
+    if (ready_) return av::ALREADY;
+
+    separate_audio_ = separate;
+
+    logi("[DISPATCHER] separate audio tracks = {}", separate_audio_);
+    return 0;
+}
+
+void Dispatcher::set_backpressure(const AVMediaType mt, const av::backpressure_t bp, const size_t capacity,
+                                  const size_t limit)
+{
+    auto& ctx = (mt == AVMEDIA_TYPE_AUDIO) ? actx_ : vctx_;
+
+    if (offline_ && bp != av::backpressure_t::block) {
+        logw("[DISPATCHER] [{}] ignore the backpressure '{}' in offline mode", av::to_char(mt),
+             av::to_string(bp));
+    }
+
+    ctx.backpressure = offline_ ? av::backpressure_t::block : bp;
+    if (capacity > 0) ctx.queue.reserve(capacity);
+    ctx.capacity = ctx.queue.capacity();
+    ctx.limit    = std::max(limit > 0 ? limit : ctx.capacity * 16, ctx.capacity);
+
+    logi("[DISPATCHER] [{}] backpressure = {}, capacity = {}, limit = {}", av::to_char(mt),
+         av::to_string(bp), ctx.queue.capacity(), ctx.limit);
+}
+
+uint64_t Dispatcher::dropped(const AVMediaType mt) const
+{
+    return (mt == AVMEDIA_TYPE_AUDIO) ? actx_.dropped.load() : vctx_.dropped.load();
+}
+
 void Dispatcher::set_output(Consumer<av::frame> *encoder) { consumer_ = encoder; }
 
+int Dispatcher::add_output(Consumer<av::frame> *consumer, const av::backpressure_t backpressure)
+{
+    if (!consumer) return av::NULLPTR;
+    if (ready_) return av::ALREADY;
+
+    auto output          = std::make_unique<OutputContext>();
+    output->consumer     = consumer;
+    output->backpressure = offline_ ? av::backpressure_t::block : backpressure;
+    // audio is never dropped unless the consumer falls far behind, see the elastic policy
+    if (output->backpressure != av::backpressure_t::block) {
+        output->audio.queue.reserve(64);
+        output->audio.capacity = 64;
+    }
+    output->audio.limit = 1024;
+
+    outputs_.emplace_back(std::move(output));
+
+    logi("[DISPATCHER] output #{} added, backpressure = {}", outputs_.size(),
+         av::to_string(outputs_.back()->backpressure));
+
+    return 0;
+}
+
 void Dispatcher::set_hwaccel(const AVHWDeviceType hwaccel) { vctx_.hwaccel = hwaccel; }
 
+void Dispatcher::set_filter_threads(const int threads) { vctx_.threads = std::max(threads, 0); }
+
+void Dispatcher::set_background(const bool background) { background_ = background; }
+
 int Dispatcher::initialize(const std::string_view& video_filters, const std::string_view& audio_filters)
 {
     if (producers_.empty() || !consumer_) return av::INVALID;
 
     vctx_.graph_desc = video_filters;
     actx_.graph_desc = audio_filters;
+    vctx_.request    = video_filters;
+    actx_.request    = audio_filters;
+
+    for (const auto type : { AVMEDIA_TYPE_AUDIO, AVMEDIA_TYPE_VIDEO }) {
+        auto& ctx = (type == AVMEDIA_TYPE_AUDIO) ? actx_ : vctx_;
+        if (!ctx.enabled) continue;
+
+        ctx.graph = std::make_unique<FilterGraph>();
+        if (create_filter_graph(type, ctx.graph_desc, *ctx.graph) < 0) return -1;
+    }
 
-    if (actx_.enabled && create_filter_graph(AVMEDIA_TYPE_AUDIO) < 0) return -1;
-    if (vctx_.enabled && create_filter_graph(AVMEDIA_TYPE_VIDEO) < 0) return -1;
+    consumer_->audio_tracks = (separate_audio_ && actx_.enabled) ? audio_inputs_.size() : 1;
+
+    vctx_.eof.assign(1, false);
+    actx_.eof.assign(std::max<size_t>(consumer_->audio_tracks, 1), false);
+
+    if (consumer_->audio_tracks > 1 && !outputs_.empty()) {
+        logw("[DISPATCHER] [A] {} separate tracks, the secondary outputs only receive the first one",
+             consumer_->audio_tracks);
+    }
 
     consumer_->enable(AVMEDIA_TYPE_AUDIO, actx_.enabled);
     consumer_->enable(AVMEDIA_TYPE_VIDEO, vctx_.enabled);
 
+    for (const auto& output : outputs_) {
+        output->consumer->enable(AVMEDIA_TYPE_AUDIO, actx_.enabled);
+        output->consumer->enable(AVMEDIA_TYPE_VIDEO, vctx_.enabled);
+    }
+
     update_encoder_format_by_sinks();
 
     ready_ = true;
     return 0;
 }
 
-int Dispatcher::create_filter_graph(const AVMediaType type)
+bool Dispatcher::create_converter(const std::string& desc, FilterGraph& fg)
 {
-    auto& ctx = (type == AVMEDIA_TYPE_AUDIO) ? actx_ : vctx_;
+    if (!desc.empty() || vctx_.hwaccel != AV_HWDEVICE_TYPE_NONE) return false;
+
+    // 1 input & 1 output
+    Producer<av::frame> *producer = nullptr;
+    for (const auto& input : producers_) {
+        if (!input->has(AVMEDIA_TYPE_VIDEO)) continue;
+        if (producer) return false;
+
+        producer = input;
+    }
+
+    if (!producer) return false;
+
+    const auto vfmt = input_vformat(producer);
+    if (!ColorConverter::supports(vfmt, consumer_->vfmt)) return false;
+
+    const auto threads   = vctx_.threads > 0 ? vctx_.threads : av::graph::default_threads();
+    auto       converter = std::make_unique<ColorConverter>();
+    if (converter->open(vfmt, consumer_->vfmt, threads) < 0) return false;
+
+    fg.srcs[producer]  = nullptr;
+    fg.sizes[producer] = { vfmt.width, vfmt.height };
+    fg.converter       = std::move(converter);
+
+    logi("[DISPATCHER] [V] no filters, using the built-in converter");
+    return true;
+}
+
+int Dispatcher::create_filter_graph(const AVMediaType type, const std::string& desc, FilterGraph& fg)
+{
+    const auto& ctx = (type == AVMEDIA_TYPE_AUDIO) ? actx_ : vctx_;
+
+    if (type == AVMEDIA_TYPE_VIDEO && create_converter(desc, fg)) return 0;
+
+    if (type == AVMEDIA_TYPE_AUDIO && separate_audio_) return create_audio_tracks(desc, fg);
 
     // 1. alloc filter graph
-    if (ctx.graph) avfilter_graph_free(&ctx.graph);
-    if (ctx.graph = avfilter_graph_alloc(); !ctx.graph) return av::NOMEM;
+    if (fg.graph = avfilter_graph_alloc(); !fg.graph) return av::NOMEM;
+
+    if (type == AVMEDIA_TYPE_VIDEO) av::graph::set_threads(fg.graph, ctx.threads);
 
     // 2. create buffersrc
     std::vector<AVFilterContext *> src_ctxs{};
@@ -74,9 +261,9 @@ int Dispatcher::create_filter_graph(const AVMediaType type)
 
         AVFilterContext *src_ctx = nullptr;
         if (type == AVMEDIA_TYPE_AUDIO) {
-            if (av::graph::create_audio_src(actx_.graph, &src_ctx, producer->afmt) < 0) return -1;
+            if (av::graph::create_audio_src(fg.graph, &src_ctx, producer->afmt) < 0) return -1;
 
-            ctx.srcs[producer] = src_ctx;
+            fg.srcs[producer] = src_ctx;
             src_ctxs.push_back(src_ctx);
         }
 
@@ -91,28 +278,27 @@ int Dispatcher::create_filter_graph(const AVMediaType type)
                 frames_ref = hwctx->frames_ctx.get();
             }
 
-            if (av::graph::create_video_src(vctx_.graph, &src_ctx, producer->vfmt, frames_ref) < 0)
-                return -1;
+            const auto vfmt = input_vformat(producer);
+            if (av::graph::create_video_src(fg.graph, &src_ctx, vfmt, frames_ref) < 0) return -1;
 
-            ctx.srcs[producer] = src_ctx;
+            fg.srcs[producer]  = src_ctx;
+            fg.sizes[producer] = { vfmt.width, vfmt.height };
             src_ctxs.push_back(src_ctx);
         }
     }
 
     // 3. create buffersink
-    if (type == AVMEDIA_TYPE_AUDIO &&
-        av::graph::create_audio_sink(actx_.graph, &actx_.sink, consumer_->afmt) < 0)
+    if (type == AVMEDIA_TYPE_AUDIO && av::graph::create_audio_sink(fg.graph, &fg.sink, consumer_->afmt) < 0)
         return -1;
-    if (type == AVMEDIA_TYPE_VIDEO &&
-        av::graph::create_video_sink(vctx_.graph, &vctx_.sink, consumer_->vfmt) < 0)
+    if (type == AVMEDIA_TYPE_VIDEO && av::graph::create_video_sink(fg.graph, &fg.sink, consumer_->vfmt) < 0)
         return -1;
 
     // 4.
-    logi("[DISPATCHER] [{}] creating filter graph: '{}'", av::to_char(type), ctx.graph_desc);
+    logi("[DISPATCHER] [{}] creating filter graph: '{}'", av::to_char(type), desc);
 
-    if (ctx.graph_desc.empty()) {
+    if (desc.empty()) {
         // 1 input & 1 output
-        if (avfilter_link(src_ctxs[0], 0, ctx.sink, 0) < 0) {
+        if (avfilter_link(src_ctxs[0], 0, fg.sink, 0) < 0) {
             loge("[DISPATCHER] [{}] failed to link filter graph", av::to_char(type));
             return -1;
         }
@@ -121,8 +307,7 @@ int Dispatcher::create_filter_graph(const AVMediaType type)
         AVFilterInOut *inputs = nullptr, *outputs = nullptr;
         defer(avfilter_inout_free(&inputs); avfilter_inout_free(&outputs));
 
-        if (avfilter_graph_parse2(ctx.graph, ctx.graph_desc.c_str(), &inputs, &outputs) < 0)
-            return av::INVALID;
+        if (avfilter_graph_parse2(fg.graph, desc.c_str(), &inputs, &outputs) < 0) return av::INVALID;
 
         // link I/O filters
         int i = 0;
@@ -134,7 +319,7 @@ int Dispatcher::create_filter_graph(const AVMediaType type)
         }
 
         for (auto ptr = outputs; ptr; ptr = ptr->next) {
-            if (avfilter_link(ptr->filter_ctx, ptr->pad_idx, ctx.sink, 0) < 0) {
+            if (avfilter_link(ptr->filter_ctx, ptr->pad_idx, fg.sink, 0) < 0) {
                 loge("[DISPATCHER] failed to link output filters");
                 return -1;
             }
@@ -142,34 +327,266 @@ int Dispatcher::create_filter_graph(const AVMediaType type)
     }
 
     if (type == AVMEDIA_TYPE_VIDEO && ctx.hwaccel != AV_HWDEVICE_TYPE_NONE) {
-        if (av::hwaccel::setup_for_filter_graph(ctx.graph, ctx.hwaccel) != 0) {
+        if (av::hwaccel::setup_for_filter_graph(fg.graph, ctx.hwaccel) != 0) {
             loge("[DISPATCHER] can not set hardware device up for filter graph.");
             return -1;
         }
     }
 
     // 5. configure
-    if (avfilter_graph_config(ctx.graph, nullptr) < 0) {
+    if (avfilter_graph_config(fg.graph, nullptr) < 0) {
         loge("[DISPATCHER] failed to configure the filter graph");
         return -1;
     }
 
-    logi("[DISPATCHER] filter graph \n{}\n", avfilter_graph_dump(ctx.graph, nullptr));
+    logi("[DISPATCHER] filter graph \n{}\n", avfilter_graph_dump(fg.graph, nullptr));
+    return 0;
+}
+
+int Dispatcher::create_audio_tracks(const std::string& desc, FilterGraph& fg)
+{
+    if (!desc.empty()) logw("[DISPATCHER] [A] separate tracks, the filters are ignored: '{}'", desc);
+
+    if (fg.graph = avfilter_graph_alloc(); !fg.graph) return av::NOMEM;
+
+    // converted to the format of the consumer by the sinks, independent of each other
+    for (const auto producer : audio_inputs_) {
+        AVFilterContext *src  = nullptr;
+        AVFilterContext *sink = nullptr;
+        if (av::graph::create_audio_src(fg.graph, &src, producer->afmt) < 0) return -1;
+        if (av::graph::create_audio_sink(fg.graph, &sink, consumer_->afmt) < 0) return -1;
+
+        if (avfilter_link(src, 0, sink, 0) < 0) {
+            loge("[DISPATCHER] [A] failed to link the track of {}", producer->name());
+            return -1;
+        }
+
+        fg.srcs[producer]   = src;
+        fg.tracks[producer] = fg.sinks.size();
+        fg.sinks.push_back(sink);
+
+        logi("[DISPATCHER] [A] track #{}: {}", fg.tracks[producer], producer->name());
+    }
+
+    if (fg.sinks.empty()) return av::INVALID;
+    fg.sink = fg.sinks[0];
+
+    if (avfilter_graph_config(fg.graph, nullptr) < 0) {
+        loge("[DISPATCHER] failed to configure the filter graph");
+        return -1;
+    }
+
+    logi("[DISPATCHER] filter graph \n{}\n", avfilter_graph_dump(fg.graph, nullptr));
+    return 0;
+}
+
+int Dispatcher::reconfigure(const AVMediaType type, const std::string_view& filters)
+{
+    if (type != AVMEDIA_TYPE_AUDIO && type != AVMEDIA_TYPE_VIDEO) return av::INVALID;
+
+    auto& ctx = (type == AVMEDIA_TYPE_AUDIO) ? actx_ : vctx_;
+    if (!ready_ || !ctx.enabled) return av::INVALID;
+
+    {
+        std::lock_guard lock(ctx.mtx);
+
+        ctx.request   = filters;
+        ctx.requested = true;
+
+        // picked up by the running builder
+        if (ctx.building) return 0;
+        ctx.building = true;
+    }
+
+    std::lock_guard lock(ctx.builder_mtx);
+
+    // the previous builder is idle and exiting, never blocks
+    if (ctx.builder.joinable()) ctx.builder.join();
+
+    ctx.builder = std::jthread([this, type, &ctx] {
+        probe::thread::set_name(fmt::format("GRAPH-BUILDER-{}", av::to_char(type)));
+        if (background_) av::lower_thread_priority();
+
+        while (true) {
+            std::string desc{};
+            {
+                std::lock_guard lock(ctx.mtx);
+
+                if (!ctx.requested) {
+                    ctx.building = false;
+                    ctx.built.notify_all();
+                    return;
+                }
+
+                desc          = ctx.request;
+                ctx.requested = false;
+            }
+
+            const auto t0 = av::clock::ns();
+
+            auto fg  = std::make_unique<FilterGraph>();
+            auto ret = create_filter_graph(type, desc, *fg);
+
+            // the encoder can not change the frame size on the fly
+            if (ret >= 0 && type == AVMEDIA_TYPE_VIDEO && fg->sink) {
+                const auto width  = consumer_->vfmt.width;
+                const auto height = consumer_->vfmt.height;
+                if (av_buffersink_get_w(fg->sink) != width || av_buffersink_get_h(fg->sink) != height) {
+                    logi("[DISPATCHER] [V] scale the output to {}x{}", width, height);
+
+                    auto scaled  = desc.empty() ? std::string{} : desc + ",";
+                    scaled      += fmt::format("scale={}:{}", width, height);
+
+                    fg  = std::make_unique<FilterGraph>();
+                    ret = create_filter_graph(type, scaled, *fg);
+                }
+            }
+
+            if (ret < 0) {
+                loge("[DISPATCHER] [{}] failed to rebuild the filter graph, keep the current one",
+                     av::to_char(type));
+                continue;
+            }
+
+            std::lock_guard lock(ctx.mtx);
+
+            ctx.pending      = std::move(fg);
+            ctx.pending_desc = desc;
+            ctx.dirty        = true;
+            ctx.built.notify_all();
+
+            logi("[DISPATCHER] [{}] filter graph rebuilt in {:%T}", av::to_char(type),
+                 av::clock::ns() - t0);
+        }
+    });
+
     return 0;
 }
 
+void Dispatcher::swap_filter_graph(const AVMediaType mt, av::frame& frame)
+{
+    auto& ctx = (mt == AVMEDIA_TYPE_AUDIO) ? actx_ : vctx_;
+
+    std::unique_ptr<FilterGraph> fg{};
+    {
+        std::lock_guard lock(ctx.mtx);
+
+        fg             = std::move(ctx.pending);
+        ctx.graph_desc = ctx.pending_desc;
+        ctx.dirty      = false;
+    }
+
+    if (!fg) return;
+
+    // drain the old graph, the frames buffered by the filters are still delivered
+    if (ctx.graph && ctx.graph->graph) {
+        for (const auto& [_, src] : ctx.graph->srcs) {
+            av_buffersrc_add_frame_flags(src, nullptr, AV_BUFFERSRC_FLAG_PUSH);
+        }
+
+        for (size_t track = 0; track < std::max<size_t>(ctx.graph->sinks.size(), 1); ++track) {
+            pull_frames(ctx, mt, frame, track);
+        }
+    }
+
+    ctx.graph = std::move(fg);
+
+    logi("[DISPATCHER] [{}] filter graph swapped: '{}'", av::to_char(mt), ctx.graph_desc);
+}
+
+av::vformat_t Dispatcher::input_vformat(Producer<av::frame> *producer)
+{
+    auto vfmt = producer->vfmt;
+
+    std::lock_guard lock(vctx_.mtx);
+    if (const auto it = vctx_.resized.find(producer); it != vctx_.resized.end()) {
+        std::tie(vfmt.width, vfmt.height) = it->second;
+    }
+    return vfmt;
+}
+
+int Dispatcher::check_input_size(Producer<av::frame> *producer, const av::frame& frame)
+{
+    auto& ctx = vctx_;
+
+    const std::pair size{ frame->width, frame->height };
+    if (ctx.graph->sizes[producer] == size) return 0;
+
+    std::unique_lock lock(ctx.mtx);
+
+    if (const auto it = ctx.resized.find(producer); it == ctx.resized.end() || it->second != size) {
+        const auto [width, height] = ctx.graph->sizes[producer];
+        logi("[DISPATCHER] [V] {} is resized: {}x{} -> {}x{}, rebuild the filter graph", producer->name(),
+             width, height, size.first, size.second);
+
+        ctx.resized[producer] = size;
+        const auto desc       = ctx.request;
+
+        lock.unlock();
+        if (reconfigure(AVMEDIA_TYPE_VIDEO, desc) < 0) return av::INVALID;
+        lock.lock();
+    }
+
+    // offline: nothing is dropped, wait for the graph
+    if (offline_) {
+        while (ctx.graph->sizes[producer] != size) {
+            ctx.built.wait(lock, [&] { return ctx.dirty || !ctx.building; });
+
+            if (!ctx.dirty) {
+                loge("[DISPATCHER] [V] failed to rebuild the filter graph for {}x{}", size.first,
+                     size.second);
+                return -1;
+            }
+
+            lock.unlock();
+
+            av::frame drained{};
+            swap_filter_graph(AVMEDIA_TYPE_VIDEO, drained);
+
+            lock.lock();
+        }
+        return 0;
+    }
+
+    // the rebuild has failed
+    if (!ctx.building && !ctx.dirty) {
+        loge("[DISPATCHER] [V] failed to rebuild the filter graph for {}x{}", size.first, size.second);
+        return -1;
+    }
+
+    return av::AGAIN;
+}
+
 int Dispatcher::update_encoder_format_by_sinks()
 {
-    if (consumer_ && consumer_->accepts(AVMEDIA_TYPE_VIDEO) && vctx_.sink) {
+    const auto vgraph    = vctx_.graph.get();
+    const auto has_video = vgraph && (vgraph->sink || vgraph->converter);
+    const auto has_audio = actx_.graph && actx_.graph->sink;
+
+    if (consumer_ && consumer_->accepts(AVMEDIA_TYPE_VIDEO) && has_video) {
         const auto vfmt = consumer_->vfmt;
-        consumer_->vfmt = av::graph::buffersink_get_video_format(vctx_.sink);
+        consumer_->vfmt = vgraph->converter ? vgraph->converter->format()
+                                            : av::graph::buffersink_get_video_format(vgraph->sink);
 
+        consumer_->input_framerate = consumer_->vfmt.framerate;
         consumer_->vfmt.framerate  = vfmt.framerate;
-        consumer_->input_framerate = av_buffersink_get_frame_rate(vctx_.sink);
     }
 
-    if (consumer_ && consumer_->accepts(AVMEDIA_TYPE_AUDIO) && actx_.sink) {
-        consumer_->afmt = av::graph::buffersink_get_audio_format(actx_.sink);
+    if (consumer_ && consumer_->accepts(AVMEDIA_TYPE_AUDIO) && has_audio) {
+        consumer_->afmt = av::graph::buffersink_get_audio_format(actx_.graph->sink);
+    }
+
+    for (const auto& output : outputs_) {
+        if (output->consumer->accepts(AVMEDIA_TYPE_VIDEO) && has_video) {
+            const auto framerate              = output->consumer->vfmt.framerate;
+            output->consumer->vfmt            = consumer_->vfmt;
+            output->consumer->vfmt.framerate  = framerate;
+            output->consumer->input_framerate = consumer_->input_framerate;
+        }
+
+        if (output->consumer->accepts(AVMEDIA_TYPE_AUDIO) && has_audio) {
+            output->consumer->afmt = consumer_->afmt;
+        }
     }
     return 0;
 }
@@ -184,6 +601,18 @@ int Dispatcher::start()
 
     if (consumer_->start() < 0) return -1;
 
+    for (auto& output : outputs_) {
+        if (output->consumer->start() < 0) return -1;
+
+        const auto ptr = output.get();
+        if (vctx_.enabled) {
+            ptr->video.thread = std::jthread([=, this] { output_fn(ptr, AVMEDIA_TYPE_VIDEO); });
+        }
+        if (actx_.enabled) {
+            ptr->audio.thread = std::jthread([=, this] { output_fn(ptr, AVMEDIA_TYPE_AUDIO); });
+        }
+    }
+
     //
     start_time_ = av::clock::ns();
     timeline_.set(0ns, start_time_);
@@ -204,6 +633,7 @@ int Dispatcher::start()
 int Dispatcher::dispatch_fn(const AVMediaType mt)
 {
     probe::thread::set_name(fmt::format("DISPATCH-{}", av::to_char(mt)));
+    if (background_) av::lower_thread_priority();
 
     logi("[{}] STARTED", av::to_char(mt));
     defer(logi("[{}] EXITED", av::to_char(mt)));
@@ -211,68 +641,189 @@ int Dispatcher::dispatch_fn(const AVMediaType mt)
     auto& ctx = (mt == AVMEDIA_TYPE_AUDIO) ? actx_ : vctx_;
 
     av::frame frame{};
+    av::frame converted{};
     while (ctx.running) {
-        if (ctx.dirty) {
-            if (create_filter_graph(mt) < 0) {
-                ctx.running = false;
-                continue;
-            }
-
-            ctx.dirty = false;
-        }
+        // at the frame boundary
+        if (ctx.dirty) swap_filter_graph(mt, frame);
 
         auto has_next = ctx.queue.wait_and_pop();
         if (!has_next || timeline_.paused()) continue;
 
         frame         = has_next.value().first;
         auto producer = has_next.value().second;
-        auto src      = ctx.srcs[producer];
+        auto src      = ctx.graph->srcs[producer];
         auto timebase = (mt == AVMEDIA_TYPE_AUDIO) ? producer->afmt.time_base : producer->vfmt.time_base;
 
-        // pts
-        if (frame && frame->pts != AV_NOPTS_VALUE)
-            frame->pts -= av::clock::to(av::clock::us() - timeline_.time(), timebase);
-
-        // send the frame to graph
-        if (av_buffersrc_add_frame_flags(src, frame.get(), AV_BUFFERSRC_FLAG_PUSH) < 0) {
-            loge("[{}] failed to send the frame to filter graph.", av::to_char(mt));
-            ctx.running = false;
-            ctx.queue.stop();
-            break;
+        // pts, relative to the start of the recording, or the source timestamps in offline mode
+        if (frame && frame->pts != AV_NOPTS_VALUE) {
+            if (offline_)
+                ctx.position = av::clock::ns(frame->pts, timebase);
+            else
+                frame->pts -= av::clock::to(av::clock::us() - timeline_.time(), timebase);
         }
 
-        // output streams
-        while (ctx.running) {
-            const int ret =
-                av_buffersink_get_frame_flags(ctx.sink, frame.put(), AV_BUFFERSINK_FLAG_NO_REQUEST);
-            if (ret == AVERROR(EAGAIN)) {
+        if (mt == AVMEDIA_TYPE_VIDEO && frame) {
+            if (const auto ret = check_input_size(producer, frame); ret == av::AGAIN) {
+                ctx.dropped++;
+                continue;
+            }
+            else if (ret < 0) {
+                ctx.running = false;
+                ctx.queue.stop();
                 break;
             }
-            else if (ret == AVERROR_EOF) {
-                logi("[{}] DISPATCH EOF", av::to_char(mt));
 
-                consumer_->consume(nullptr, mt);
-                break;
+            // swapped in while waiting
+            src = ctx.graph->srcs[producer];
+        }
+
+        // built-in converter, no filter graph
+        if (const auto& converter = ctx.graph->converter) {
+            if (!frame) {
+                deliver_eof(mt, 0);
+                continue;
             }
-            else if (ret < 0) {
-                loge("[{}] failed to get frame: {}", av::to_char(mt), av::ff_errstr(ret));
+
+            const auto t0 = av::clock::ns();
+            if (converter->convert(frame, converted) < 0) {
+                loge("[{}] failed to convert the frame.", av::to_char(mt));
                 ctx.running = false;
                 ctx.queue.stop();
                 break;
             }
+            update_filter_time(ctx, av::clock::ns() - t0);
+
+            deliver(converted, mt);
+            continue;
+        }
+
+        // send the frame to graph, the filters run right away with AV_BUFFERSRC_FLAG_PUSH
+        const auto t0 = av::clock::ns();
+        if (av_buffersrc_add_frame_flags(src, frame.get(), AV_BUFFERSRC_FLAG_PUSH) < 0) {
+            loge("[{}] failed to send the frame to filter graph.", av::to_char(mt));
+            ctx.running = false;
+            ctx.queue.stop();
+            break;
+        }
+        if (mt == AVMEDIA_TYPE_VIDEO) update_filter_time(ctx, av::clock::ns() - t0);
 
-            consumer_->consume(frame, mt);
+        // output streams
+        const auto track = ctx.graph->track(producer);
+        if (const int ret = pull_frames(ctx, mt, frame, track); ret == AVERROR_EOF) {
+            logi("[{}] DISPATCH EOF", av::to_char(mt));
+
+            deliver_eof(mt, track);
+        }
+        else if (ret < 0 && ret != AVERROR(EAGAIN)) {
+            loge("[{}] failed to get frame: {}", av::to_char(mt), av::ff_errstr(ret));
+            ctx.running = false;
+            ctx.queue.stop();
         }
     }
 
-    consumer_->consume(nullptr, mt);
+    deliver_eof(mt);
 
     return 0;
 }
 
-void Dispatcher::pause() { timeline_.pause(); }
+int Dispatcher::pull_frames(DispatchContext& ctx, const AVMediaType mt, av::frame& frame,
+                            const size_t track)
+{
+    const auto sink = ctx.graph->sink_of(track);
+    while (ctx.running) {
+        const int ret = av_buffersink_get_frame_flags(sink, frame.put(), AV_BUFFERSINK_FLAG_NO_REQUEST);
+        if (ret < 0) return ret;
+
+        deliver(frame, mt, track);
+    }
+
+    return AVERROR(EAGAIN);
+}
+
+void Dispatcher::update_filter_time(DispatchContext& ctx, const std::chrono::nanoseconds elapsed)
+{
+    ctx.filtered        += 1;
+    ctx.filter_time     += elapsed;
+    ctx.max_filter_time  = std::max(ctx.max_filter_time, elapsed);
+}
+
+void Dispatcher::deliver(const av::frame& frame, const AVMediaType mt, const size_t track)
+{
+    // secondary consumers first, by reference, so that the primary one can not delay them
+    // they only receive the first audio track
+    for (const auto& output : outputs_) {
+        if (track != 0) break;
+
+        auto& lane = (mt == AVMEDIA_TYPE_AUDIO) ? output->audio : output->video;
+
+        // EOF is never dropped, or the output never finishes
+        if (!frame) {
+            if (output->backpressure == av::backpressure_t::block)
+                lane.queue.wait_and_push(av::frame{ frame });
+            else
+                lane.queue.evict_and_push(av::frame{ frame });
+            continue;
+        }
+
+        const auto bp =
+            (mt == AVMEDIA_TYPE_AUDIO && output->backpressure != av::backpressure_t::block)
+                ? av::backpressure_t::elastic
+                : output->backpressure;
+
+        if (!push_or_drop(lane.queue, av::frame{ frame }, bp, lane.capacity, lane.limit)) {
+            const auto dropped = ++lane.dropped;
+
+            if (bp == av::backpressure_t::elastic)
+                logw("[{}] output queue reached its limit {}, drop the oldest frame, dropped = {}",
+                     av::to_char(mt), lane.limit, dropped);
+            else
+                logd("[{}] output queue is full, drop a frame ({})", av::to_char(mt), av::to_string(bp));
+        }
+    }
+
+    consumer_->consume(frame, mt, track);
+}
+
+void Dispatcher::deliver_eof(const AVMediaType mt, const size_t track)
+{
+    auto& ctx = (mt == AVMEDIA_TYPE_AUDIO) ? actx_ : vctx_;
+
+    if (track >= ctx.eof.size() || ctx.eof[track]) return;
+
+    ctx.eof[track] = true;
+    deliver(nullptr, mt, track);
+}
+
+void Dispatcher::deliver_eof(const AVMediaType mt)
+{
+    const auto& ctx = (mt == AVMEDIA_TYPE_AUDIO) ? actx_ : vctx_;
+
+    for (size_t track = 0; track < ctx.eof.size(); ++track) {
+        deliver_eof(mt, track);
+    }
+}
+
+void Dispatcher::output_fn(OutputContext *output, const AVMediaType mt)
+{
+    probe::thread::set_name(fmt::format("DISPATCH-OUT-{}", av::to_char(mt)));
+    if (background_) av::lower_thread_priority();
+
+    auto& lane = (mt == AVMEDIA_TYPE_AUDIO) ? output->audio : output->video;
+
+    while (const auto frame = lane.queue.wait_and_pop()) {
+        output->consumer->consume(frame.value(), mt);
+    }
+}
+
+void Dispatcher::pause()
+{
+    if (!offline_) timeline_.pause();
+}
 
-void Dispatcher::resume() { timeline_.resume(); }
+void Dispatcher::resume()
+{
+    if (!offline_) timeline_.resume();
+}
 
 void Dispatcher::stop()
 {
@@ -287,25 +838,58 @@ void Dispatcher::stop()
         producer->stop();
     }
 
-    // consumer
-    if (consumer_) consumer_->stop();
-
-    // dispatcher
+    // dispatcher, joined before stopping the consumer since the consumer queues are single-producer
     vctx_.running = false;
     actx_.running = false;
 
     if (vctx_.thread.joinable()) vctx_.thread.join();
     if (actx_.thread.joinable()) actx_.thread.join();
 
-    logi("[DISPATCHER] STOPPED");
+    for (auto ctx : { &vctx_, &actx_ }) {
+        std::lock_guard lock(ctx->builder_mtx);
+        if (ctx->builder.joinable()) ctx->builder.join();
+    }
+
+    // consumer
+    if (consumer_) consumer_->stop();
+
+    for (auto& output : outputs_) {
+        // wait <= 3s for draining
+        for (int i = 0; (i < 300) && (!output->video.queue.empty() || !output->audio.queue.empty()); i++) {
+            std::this_thread::sleep_for(10ms);
+        }
+
+        output->video.queue.stop();
+        output->audio.queue.stop();
+
+        if (output->video.thread.joinable()) output->video.thread.join();
+        if (output->audio.thread.joinable()) output->audio.thread.join();
+
+        output->consumer->stop();
+
+        logi("[DISPATCHER] output stopped, dropped: [V] {}, [A] {}", output->video.dropped.load(),
+             output->audio.dropped.load());
+    }
+
+    if (vctx_.filtered) {
+        int threads = 0;
+        if (const auto vgraph = vctx_.graph.get(); vgraph) {
+            threads = vgraph->converter ? vgraph->converter->threads() : vgraph->graph->nb_threads;
+        }
+        const auto avg     = vctx_.filter_time / static_cast<int64_t>(vctx_.filtered);
+        logi("[DISPATCHER] [V] {} frames filtered, threads = {}, avg = {:%T}, max = {:%T}", vctx_.filtered,
+             threads, avg, vctx_.max_filter_time);
+    }
+
+    logi("[DISPATCHER] STOPPED, dropped: [V] {}, [A] {}", vctx_.dropped.load(), actx_.dropped.load());
 }
 
 Dispatcher::~Dispatcher()
 {
     stop();
 
-    avfilter_graph_free(&vctx_.graph);
-    avfilter_graph_free(&actx_.graph);
+    vctx_.graph = nullptr;
+    actx_.graph = nullptr;
 
     logi("[DISPATCHER] ~");
 }
@@ -314,5 +898,7 @@ std::chrono::nanoseconds Dispatcher::escaped() const
 {
     if (!running()) return 0ns;
 
+    if (offline_) return std::max({ vctx_.position.load(), actx_.position.load(), 0ns });
+
     return timeline_.time();
 }
@@ -2,8 +2,11 @@
 
 #include "libcap/clock.h"
 #include "libcap/hwaccel.h"
+#include "libcap/priority.h"
 #include "logging.h"
 
+#include <algorithm>
+#include <filesystem>
 #include <fmt/chrono.h>
 #include <fmt/ranges.h>
 #include <probe/defer.h>
@@ -11,6 +14,7 @@
 extern "C" {
 #include <libavcodec/avcodec.h>
 #include <libavformat/avformat.h>
+#include <libavutil/opt.h>
 #include <libavutil/time.h>
 }
 
@@ -25,6 +29,7 @@ int Encoder::open(const std::string& filename, std::map<std::string, std::string
 
     const auto vcodec_name = options.contains("vcodec") ? options.at("vcodec") : "libx264";
     const auto acodec_name = options.contains("acodec") ? options.at("acodec") : "aac";
+    threads_               = options.contains("threads") ? options.at("threads") : "auto";
     preset_                = options.contains("preset") ? options.at("preset") : std::string{};
     profile_               = options.contains("profile") ? options.at("profile") : std::string{};
     tune_                  = options.contains("tune") ? options.at("tune") : std::string{};
@@ -40,27 +45,89 @@ int Encoder::open(const std::string& filename, std::map<std::string, std::string
         crf_ = std::clamp<int>(std::stoi(options.at("crf")), 0, 51);
     }
 
+    // replay mode, seconds / MiB
+    if (options.contains("replay_duration") || options.contains("replay_size")) {
+        int64_t  duration = 0;
+        uint64_t size     = 0;
+        if (options.contains("replay_duration")) duration = std::stoll(options.at("replay_duration"));
+        if (options.contains("replay_size")) size = std::stoull(options.at("replay_size"));
+
+        replay_ = std::make_unique<ReplayBuffer>(std::chrono::seconds{ duration }, size << 20);
+    }
+
+    // output file: KiB / MiB
+    if (options.contains("io_buffer_size")) {
+        ofile_options_.buffer_size = std::stoull(options.at("io_buffer_size")) << 10;
+    }
+    if (options.contains("direct_io")) {
+        ofile_options_.direct = options.at("direct_io") == "1" || options.at("direct_io") == "true";
+    }
+    if (options.contains("preallocate")) {
+        ofile_options_.preallocate = std::stoll(options.at("preallocate")) << 20;
+    }
+
+    // offline transcoding: block the input instead of dropping the audio samples
+    if (options.contains("offline")) {
+        offline_ = options.at("offline") == "1" || options.at("offline") == "true";
+    }
+
+    // background jobs: the threads of the encoder run at a lower priority, see av::lower_thread_priority()
+    if (options.contains("background")) {
+        background_ = options.at("background") == "1" || options.at("background") == "true";
+    }
+
+    // fragmented MP4 / live Matroska, seconds: the file is playable up to the last fragment after a
+    // crash, and the muxer does not keep the index of the whole file in memory
+    if (options.contains("fragment_duration")) {
+        const auto seconds = std::stod(options.at("fragment_duration"));
+        fragment_duration_ = av::clock::ns(std::chrono::duration<double>(seconds));
+    }
+
+    // rotation: a new file is started at the first key frame after the duration (seconds) or the size
+    // (MiB), named <prefix>yyyy-MM-dd_hhmmss_zzz.<ext> in the directory of the first one
+    if (options.contains("segment_duration")) {
+        segment_duration_ = std::chrono::seconds{ std::stoll(options.at("segment_duration")) };
+    }
+    if (options.contains("segment_size")) {
+        segment_size_ = std::stoll(options.at("segment_size")) << 20;
+    }
+    if (options.contains("segment_prefix")) {
+        segment_prefix_ = options.at("segment_prefix");
+    }
+
+    // step the video quality down when the encoder falls behind, see QualityGovernor
+    if (options.contains("adaptive_quality")) {
+        adaptive_ = options.at("adaptive_quality") == "1" || options.at("adaptive_quality") == "true";
+    }
+
     // format context
     if (avformat_alloc_output_context2(&fmt_ctx_, nullptr, nullptr, filename.c_str()) < 0)
         return av::INVALID;
 
     // streams
     if (video_enabled_ && new_video_stream(vcodec_name) < 0) return -1;
-    if (audio_enabled_ && new_audio_stream(acodec_name) < 0) return -1;
+    for (size_t i = 0; audio_enabled_ && i < std::max<size_t>(audio_tracks, 1); ++i) {
+        if (new_audio_stream(acodec_name) < 0) return -1;
+    }
 
-    // output file
-    if (!(fmt_ctx_->oformat->flags & AVFMT_NOFILE)) {
-        if (avio_open(&fmt_ctx_->pb, filename.c_str(), AVIO_FLAG_WRITE) < 0) {
-            loge("[   ENCODER] can not open the output file: {}", filename);
+    // replay mode: nothing is written until save_replay()
+    if (replay_) {
+        if (replay_->open(fmt_ctx_) < 0) {
+            loge("[   ENCODER] failed to open the replay buffer");
             return -1;
         }
-    }
 
-    if (avformat_write_header(fmt_ctx_, nullptr) < 0) {
-        loge("[   ENCODER] can not write the header to the output file: ", filename);
-        return -1;
+        logi("[   ENCODER] [{}] is opened in replay mode", filename);
+
+        ready_ = true;
+        return 0;
     }
 
+    if (open_output(fmt_ctx_, filename) < 0) return -1;
+
+    octx_     = fmt_ctx_;
+    filename_ = filename;
+
     header_written_ = true;
 
     av_dump_format(fmt_ctx_, 0, filename.c_str(), 1);
@@ -72,6 +139,57 @@ int Encoder::open(const std::string& filename, std::map<std::string, std::string
     return 0;
 }
 
+int Encoder::open_output(AVFormatContext *ctx, const std::string& filename)
+{
+    if (!(ctx->oformat->flags & AVFMT_NOFILE)) {
+        ofile_ = std::make_unique<OutputFile>();
+        if (ofile_->open(filename, ofile_options_) < 0) {
+            loge("[   ENCODER] can not open the output file: {}", filename);
+            return -1;
+        }
+
+        ctx->pb     = ofile_->context();
+        ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+
+    AVDictionary *muxer_options = nullptr;
+    defer(av_dict_free(&muxer_options));
+    if (fragment_duration_ > 0ns) set_fragment_options(ctx, &muxer_options);
+
+    if (avformat_write_header(ctx, &muxer_options) < 0) {
+        loge("[   ENCODER] can not write the header to the output file: {}", filename);
+        return -1;
+    }
+
+    return 0;
+}
+
+void Encoder::set_fragment_options(AVFormatContext *ctx, AVDictionary **options)
+{
+    const std::string_view format = ctx->oformat->name;
+    const auto             us     = duration_cast<std::chrono::microseconds>(fragment_duration_);
+
+    if (format == "mp4" || format == "mov" || format == "ipod") {
+        // cut at the first key frame after the duration, the moov only describes the tracks
+        av_dict_set(options, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+        av_dict_set_int(options, "min_frag_duration", us.count(), 0);
+    }
+    else if (format == "matroska" || format == "webm") {
+        // no cues, the clusters are complete on their own
+        av_dict_set(options, "live", "1", 0);
+        av_dict_set_int(options, "cluster_time_limit", us.count() / 1000, 0);
+    }
+    else {
+        logw("[   ENCODER] fragmented output is not supported by '{}', ignored", format);
+        return;
+    }
+
+    // the muxers buffer a fragment internally, so only the finished fragments are flushed to the file
+    ctx->flush_packets = 1;
+
+    logi("[   ENCODER] fragmented output, {} / fragment", fragment_duration_);
+}
+
 int Encoder::new_video_stream(const std::string& codec_name)
 {
     logi("[   ENCODER] [V] <<< [{}], {}:{}", codec_name, av::to_string(vfmt), av::to_string(vfmt.color));
@@ -94,7 +212,7 @@ int Encoder::new_video_stream(const std::string& codec_name)
 
     AVDictionary *options = nullptr;
     defer(av_dict_free(&options));
-    av_dict_set(&options, "threads", "auto", 0);
+    av_dict_set(&options, "threads", threads_.c_str(), 0);
     av_dict_set(&options, (vfmt.hwaccel) ? "cq" : "crf", std::to_string(crf_).c_str(), 0);
     if (!preset_.empty()) av_dict_set(&options, "preset", preset_.c_str(), 0);
     if (!profile_.empty()) av_dict_set(&options, "profile", profile_.c_str(), 0);
@@ -131,6 +249,15 @@ int Encoder::new_video_stream(const std::string& codec_name)
     if (avcodec_parameters_from_context(fmt_ctx_->streams[vstream_idx_]->codecpar, vcodec_ctx_) < 0)
         return av::INVALID;
 
+    // the input frames are never dropped in offline mode, and the decimated frames are only filled in by
+    // the duplication of the CFR sync, the other modes would leave gaps in the video
+    if (adaptive_ && !offline_) {
+        if (vsync_ == av::vsync_t::cfr)
+            governor_ = std::make_unique<QualityGovernor>(av::clock::ns(1, av_inv_q(input_framerate)));
+        else
+            logw("[   ENCODER] adaptive quality requires the CFR video sync, ignored");
+    }
+
     if (vstream_idx_ >= 0) {
         logi("[   ENCODER] [V] >>> [{}], {}:{}, tbc={}, tbn={}, hwaccel={}", codec_name,
              av::to_string(vfmt), av::to_string(vfmt.color), vcodec_ctx_->time_base,
@@ -149,49 +276,61 @@ int Encoder::new_audio_stream(const std::string& codec_name)
         loge("[   ENCODER] filed to create audio streams.");
         return -1;
     }
-    astream_idx_ = stream->index;
+
+    auto& track       = atracks_.emplace_back(std::make_unique<audio_track_t>());
+    track->stream_idx = stream->index;
+    if (astream_idx_ < 0) astream_idx_ = stream->index;
 
     auto audio_encoder = avcodec_find_encoder_by_name(codec_name.c_str());
     if (!audio_encoder) return av::NOT_FOUND;
 
-    acodec_ctx_ = avcodec_alloc_context3(audio_encoder);
-    if (!acodec_ctx_) {
+    const auto codec = track->codec = avcodec_alloc_context3(audio_encoder);
+    if (!codec) {
         loge("[   ENCODER] failed to alloc the audio encoder context.");
         return -1;
     }
 
-    acodec_ctx_->sample_rate                   = afmt.sample_rate;
-    acodec_ctx_->ch_layout                     = afmt.ch_layout;
-    acodec_ctx_->sample_fmt                    = afmt.sample_fmt;
-    acodec_ctx_->time_base                     = { 1, afmt.sample_rate };
-    fmt_ctx_->streams[astream_idx_]->time_base = afmt.time_base;
+    codec->sample_rate = afmt.sample_rate;
+    codec->ch_layout   = afmt.ch_layout;
+    codec->sample_fmt  = afmt.sample_fmt;
+    codec->time_base   = { 1, afmt.sample_rate };
+    stream->time_base  = afmt.time_base;
 
     if (fmt_ctx_->oformat->flags & AVFMT_GLOBALHEADER) {
-        acodec_ctx_->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+        codec->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
 
     AVDictionary *options = nullptr;
     defer(av_dict_free(&options));
     av_dict_set(&options, "threads", "auto", 0);
 
-    if (avcodec_open2(acodec_ctx_, audio_encoder, &options) < 0) {
+    if (avcodec_open2(codec, audio_encoder, &options) < 0) {
         loge("[   ENCODER] failed to open audio encoder");
         return -1;
     }
 
-    if (avcodec_parameters_from_context(fmt_ctx_->streams[astream_idx_]->codecpar, acodec_ctx_) < 0)
-        return av::INVALID;
+    if (avcodec_parameters_from_context(stream->codecpar, codec) < 0) return av::INVALID;
 
-    abuffer_ = std::make_unique<safe_audio_fifo>(afmt.sample_fmt, afmt.ch_layout.nb_channels,
-                                                 acodec_ctx_->frame_size * 4);
+    track->buffer = std::make_unique<safe_audio_fifo>(afmt.sample_fmt, afmt.ch_layout.nb_channels,
+                                                      codec->frame_size * 4);
 
-    if (astream_idx_ >= 0) {
-        logi("[   ENCODER] [A] >>> [{}], sample_rate={}:sample_fmt={}:channels={}:tbc={}:tbn={}",
-             codec_name, acodec_ctx_->sample_rate, av::to_string(acodec_ctx_->sample_fmt),
-             acodec_ctx_->ch_layout.nb_channels, acodec_ctx_->time_base,
-             fmt_ctx_->streams[astream_idx_]->time_base);
+    // the frames are allocated once and reused round-robin by the audio encoding thread
+    for (auto& frame : track->frames) {
+        av_channel_layout_copy(&frame->ch_layout, &codec->ch_layout);
+        frame->nb_samples  = codec->frame_size;
+        frame->format      = codec->sample_fmt;
+        frame->sample_rate = codec->sample_rate;
+
+        if (av_frame_get_buffer(frame.get(), 0) < 0) {
+            loge("[   ENCODER] failed to allocate the audio frames");
+            return av::NOMEM;
+        }
     }
 
+    logi("[   ENCODER] [A] #{} >>> [{}], sample_rate={}:sample_fmt={}:channels={}:tbc={}:tbn={}",
+         atracks_.size() - 1, codec_name, codec->sample_rate, av::to_string(codec->sample_fmt),
+         codec->ch_layout.nb_channels, codec->time_base, stream->time_base);
+
     return 0;
 }
 
@@ -213,27 +352,71 @@ void Encoder::enable(const AVMediaType type, const bool v)
     }
 }
 
-int Encoder::consume(const av::frame& frame, const AVMediaType type)
+int Encoder::consume(const av::frame& frame, const AVMediaType type) { return consume(frame, type, 0); }
+
+int Encoder::consume(const av::frame& frame, const AVMediaType type, const size_t idx)
 {
     switch (type) {
-    case AVMEDIA_TYPE_VIDEO: vbuffer_.wait_and_push(frame); return 0;
+    case AVMEDIA_TYPE_VIDEO:
+        vbuffer_.wait_and_push(frame);
+        notify(AVMEDIA_TYPE_VIDEO);
+        return 0;
+
+    case AVMEDIA_TYPE_AUDIO: {
+        if (idx >= atracks_.size()) return av::INVALID;
+
+        auto& track = *atracks_[idx];
 
-    case AVMEDIA_TYPE_AUDIO:
         if (!frame || frame->nb_samples == 0) {
-            logi("[A] INPUT EOF");
-            asrc_eof_ = true;
+            logi("[A] #{} INPUT EOF", idx);
+            track.src_eof = true;
+            notify(AVMEDIA_TYPE_AUDIO);
             return 0;
         }
 
-        abuffer_->write(reinterpret_cast<void **>(frame->data), frame->nb_samples);
-        audio_pts_ = frame->pts + abuffer_->size();
+        const auto buffer = track.buffer.get();
+        if (offline_) {
+            // wait_and_write() needs room for the whole frame
+            if (frame->nb_samples >= buffer->capacity()) buffer->reserve(frame->nb_samples * 2);
+
+            buffer->wait_and_write(reinterpret_cast<void **>(frame->data), frame->nb_samples);
+        }
+        else {
+            buffer->write(reinterpret_cast<void **>(frame->data), frame->nb_samples);
+        }
+        track.pts = frame->pts + buffer->size();
+
+        // wake the encoder only when a whole audio frame is available
+        if (buffer->size() >= track.codec->frame_size) notify(AVMEDIA_TYPE_AUDIO);
 
         return 0;
+    }
 
     default: return -1;
     }
 }
 
+void Encoder::notify(const AVMediaType type)
+{
+    auto& events = (type == AVMEDIA_TYPE_VIDEO) ? vevents_ : aevents_;
+
+    events.fetch_add(1, std::memory_order_release);
+    events.notify_one();
+}
+
+void Encoder::notify_all()
+{
+    notify(AVMEDIA_TYPE_VIDEO);
+    notify(AVMEDIA_TYPE_AUDIO);
+}
+
+bool Encoder::audio_ready() const
+{
+    if (eof_ & A_ENCODING_EOF) return false;
+
+    return std::ranges::any_of(atracks_, [](const auto& track) { return track->ready(); });
+}
+
 int Encoder::start()
 {
     if (!ready_ || running_) {
@@ -242,21 +425,62 @@ int Encoder::start()
     }
 
     running_ = true;
-    thread_  = std::jthread([this]() {
-        probe::thread::set_name("ENCODER");
 
-        while (running_ && !eof()) {
-            if (vbuffer_.empty() && (!abuffer_ || abuffer_->empty())) {
-                std::this_thread::sleep_for(20ms);
-                continue;
+    if (vstream_idx_ >= 0) {
+        thread_ = std::jthread([this]() {
+            probe::thread::set_name("ENCODER-V");
+            if (background_) av::lower_thread_priority();
+
+            while (running_ && !(eof_ & V_ENCODING_EOF)) {
+                // load the epoch before checking, a signal in between makes the wait return immediately
+                const auto events = vevents_.load(std::memory_order_acquire);
+
+                if (vbuffer_.empty()) {
+                    vevents_.wait(events, std::memory_order_acquire);
+                    continue;
+                }
+
+                process_video_frames();
+            }
+
+            logi("[    ENCODER] [V] encoded frames: {}, exited", vcodec_ctx_->frame_num);
+        });
+    }
+
+    // audio has its own thread, so a slow video encoder never lets the audio fifo grow.
+    // the audio and video packets are no longer queued in pts order: the muxer, the segments and the replay
+    // buffer write them with av_interleaved_write_frame(), which interleaves the streams by dts
+    if (astream_idx_ >= 0) {
+        athread_ = std::jthread([this]() {
+            probe::thread::set_name("ENCODER-A");
+            if (background_) av::lower_thread_priority();
+
+            while (running_ && !(eof_ & A_ENCODING_EOF)) {
+                const auto events = aevents_.load(std::memory_order_acquire);
+
+                if (!audio_ready()) {
+                    aevents_.wait(events, std::memory_order_acquire);
+                    continue;
+                }
+
+                process_audio_frames();
             }
 
-            if (vstream_idx_ >= 0) process_video_frames();
-            if (astream_idx_ >= 0) process_audio_frames();
-        } // running
+            for (size_t i = 0; i < atracks_.size(); ++i) {
+                logi("[    ENCODER] [A] #{} encoded frames: {}", i, atracks_[i]->codec->frame_num);
+            }
+            logi("[    ENCODER] [A] exited");
+        });
+    }
 
-        logi("[    ENCODER] encoded frames: {}, exited", vcodec_ctx_->frame_num);
-    });
+    // the packets are written on a separate thread, so that the encoding never waits for the disk
+    if (!replay_) {
+        muxer_ = std::jthread([this] {
+            probe::thread::set_name("MUXER");
+            if (background_) av::lower_thread_priority();
+            mux_packets();
+        });
+    }
 
     return 0;
 }
@@ -320,7 +544,8 @@ std::pair<int, int> Encoder::video_sync_process(av::frame& vframe)
     if (num_frames == 0) {
         logw("[V] drop the frame.");
     }
-    else if (num_frames > 1) {
+    // expected while decimating
+    else if (num_frames > 1 && (!governor_ || governor_->current().decimation == 1)) {
         logw("[V] duplicated {} frames and {} previous frames.", num_frames - 1, num_pre_frames);
     }
 
@@ -331,7 +556,15 @@ int Encoder::process_video_frames()
 {
     if (vbuffer_.empty()) return AVERROR(EAGAIN);
 
-    auto vframe                       = vbuffer_.pop().value();
+    const auto t0 = av::clock::ns();
+    defer(if (governor_) adapt_quality(av::clock::ns() - t0));
+
+    auto vframe = vbuffer_.pop().value();
+
+    // decimation: skip the frame, the CFR sync duplicates the next one in its place
+    const auto decimation = governor_ ? governor_->current().decimation : 1;
+    if (vframe && decimation > 1 && (vinputs_++ % decimation) != 0) return 0;
+
     auto [num_frames, num_pre_frames] = video_sync_process(vframe);
 
     av::frame encoding_frame{};
@@ -347,7 +580,7 @@ int Encoder::process_video_frames()
 
         int ret = avcodec_send_frame(vcodec_ctx_, encoding_frame.get());
         while (ret >= 0) {
-            ret = avcodec_receive_packet(vcodec_ctx_, packet_.put());
+            ret = avcodec_receive_packet(vcodec_ctx_, vpacket_.put());
             if (ret == AVERROR(EAGAIN)) {
                 break;
             }
@@ -361,20 +594,20 @@ int Encoder::process_video_frames()
                 return ret;
             }
 
-            av_packet_rescale_ts(packet_.get(), vcodec_ctx_->time_base,
+            av_packet_rescale_ts(vpacket_.get(), vcodec_ctx_->time_base,
                                  fmt_ctx_->streams[vstream_idx_]->time_base);
 
-            if (v_last_dts_ != AV_NOPTS_VALUE && v_last_dts_ >= packet_->dts) {
-                logw("[V] drop the packet with dts {} <= {}", packet_->dts, v_last_dts_);
+            if (v_last_dts_ != AV_NOPTS_VALUE && v_last_dts_ >= vpacket_->dts) {
+                logw("[V] drop the packet with dts {} <= {}", vpacket_->dts, v_last_dts_);
                 continue;
             }
-            v_last_dts_ = packet_->dts;
+            v_last_dts_ = vpacket_->dts;
 
-            logd("[V] pts = {:>14d}, dts = {:>14d}, ts = {:.3%T}", packet_->pts, packet_->dts,
-                 av::clock::ns(packet_->pts, fmt_ctx_->streams[vstream_idx_]->time_base));
+            logd("[V] pts = {:>14d}, dts = {:>14d}, ts = {:.3%T}", vpacket_->pts, vpacket_->dts,
+                 av::clock::ns(vpacket_->pts, fmt_ctx_->streams[vstream_idx_]->time_base));
 
-            packet_->stream_index = vstream_idx_;
-            if (av_interleaved_write_frame(fmt_ctx_, packet_.get()) != 0) {
+            vpacket_->stream_index = vstream_idx_;
+            if (write_packet(vpacket_) != 0) {
                 loge("[V] failed to write the the packet to file.");
                 return -1;
             }
@@ -388,49 +621,83 @@ int Encoder::process_video_frames()
     return 0;
 }
 
+void Encoder::adapt_quality(const std::chrono::nanoseconds elapsed)
+{
+    const auto prev = governor_->level();
+    if (!governor_->update(elapsed, vbuffer_.size(), vbuffer_.capacity())) return;
+
+    const auto& level = governor_->current();
+
+    // libx264 reconfigures itself before the next frame if the crf has been changed
+    if (crf_ >= 0 && std::string_view{ vcodec_ctx_->codec->name } == "libx264") {
+        av_opt_set_double(vcodec_ctx_->priv_data, "crf", std::clamp(crf_ + level.crf, 0, 51), 0);
+    }
+
+    logi("[   ENCODER] [V] quality {} -> {}: crf {:+}, 1/{} frames, load = {:.2f}, queue = {}/{}", prev,
+         governor_->level(), level.crf, level.decimation, governor_->load(), vbuffer_.size(),
+         vbuffer_.capacity());
+}
+
 int Encoder::process_audio_frames()
 {
-    if (abuffer_->size() < acodec_ctx_->frame_size && !asrc_eof_) return AVERROR(EAGAIN);
+    int ret = 0;
+    for (const auto& track : atracks_) {
+        if (track->ready()) ret = std::min(ret, process_audio_frames(*track));
+    }
+
+    if (std::ranges::all_of(atracks_, [](const auto& track) { return track->eof; })) {
+        eof_ |= A_ENCODING_EOF;
+    }
 
-    const auto stream = fmt_ctx_->streams[astream_idx_];
-    av::frame  aframe{};
+    return ret;
+}
+
+int Encoder::process_audio_frames(audio_track_t& track)
+{
+    const auto codec  = track.codec;
+    const auto buffer = track.buffer.get();
+    const auto stream = fmt_ctx_->streams[track.stream_idx];
+
+    if (buffer->size() < codec->frame_size && !track.src_eof) return AVERROR(EAGAIN);
 
     int ret = 0;
     // encode and write to the output
-    while (!(eof_ & A_ENCODING_EOF) && (abuffer_->size() >= acodec_ctx_->frame_size || asrc_eof_)) {
+    while (!track.eof && (buffer->size() >= codec->frame_size || track.src_eof)) {
 
-        if ((abuffer_->size() >= acodec_ctx_->frame_size) || (!abuffer_->empty() && asrc_eof_)) {
-            aframe.unref();
+        if ((buffer->size() >= codec->frame_size) || (!buffer->empty() && track.src_eof)) {
+            auto& aframe = track.frames[track.frame_idx++ % track.frames.size()];
 
-            av_channel_layout_copy(&aframe->ch_layout, &stream->codecpar->ch_layout);
-            aframe->nb_samples  = std::min(acodec_ctx_->frame_size, abuffer_->size());
-            aframe->format      = stream->codecpar->format;
-            aframe->sample_rate = stream->codecpar->sample_rate;
-            aframe->pts         = audio_pts_ - abuffer_->size();
+            // reallocates only if the encoder still holds a reference to the buffer
+            if (av_frame_make_writable(aframe.get()) < 0) {
+                loge("[A] failed to make the frame writable");
+                return AVERROR(ENOMEM);
+            }
 
-            av_frame_get_buffer(aframe.get(), 0);
+            aframe->nb_samples = std::min(codec->frame_size, buffer->size());
+            aframe->pts        = track.pts - buffer->size();
 
-            CHECK(abuffer_->read(reinterpret_cast<void **>(aframe->data), aframe->nb_samples) >=
+            CHECK(buffer->read(reinterpret_cast<void **>(aframe->data), aframe->nb_samples) >=
                   aframe->nb_samples);
 
-            ret = avcodec_send_frame(acodec_ctx_, aframe.get());
+            ret = avcodec_send_frame(codec, aframe.get());
         }
-        else if (asrc_eof_) {
-            ret = avcodec_send_frame(acodec_ctx_, nullptr);
+        else if (track.src_eof) {
+            ret = avcodec_send_frame(codec, nullptr);
         }
         else {
             loge("[A] unknown error");
             break;
         }
 
+        auto& packet = track.packet;
         while (ret >= 0) {
-            ret = avcodec_receive_packet(acodec_ctx_, packet_.put());
+            ret = avcodec_receive_packet(codec, packet.put());
             if (ret == AVERROR(EAGAIN)) {
                 break;
             }
             else if (ret == AVERROR_EOF) {
-                logi("[A] EOF");
-                eof_ |= A_ENCODING_EOF;
+                logi("[A] EOF, stream #{}", track.stream_idx);
+                track.eof = true;
                 break;
             }
             else if (ret < 0) {
@@ -438,20 +705,20 @@ int Encoder::process_audio_frames()
                 return ret;
             }
 
-            av_packet_rescale_ts(packet_.get(), acodec_ctx_->time_base, stream->time_base);
+            av_packet_rescale_ts(packet.get(), codec->time_base, stream->time_base);
 
-            if (a_last_dts_ != AV_NOPTS_VALUE && a_last_dts_ >= packet_->dts) {
-                logw("[A] drop the frame: dts {} <= {}", packet_->dts, a_last_dts_);
+            if (track.last_dts != AV_NOPTS_VALUE && track.last_dts >= packet->dts) {
+                logw("[A] drop the frame: dts {} <= {}", packet->dts, track.last_dts);
                 continue;
             }
-            a_last_dts_ = packet_->dts;
+            track.last_dts = packet->dts;
 
-            logd("[A] pts = {:>14d}, dts = {:>14d}, ts = {:.3%T}", packet_->pts, packet_->dts,
-                 av::clock::ns(packet_->pts, stream->time_base));
+            logd("[A] pts = {:>14d}, dts = {:>14d}, ts = {:.3%T}", packet->pts, packet->dts,
+                 av::clock::ns(packet->pts, stream->time_base));
 
-            packet_->stream_index = astream_idx_;
+            packet->stream_index = track.stream_idx;
 
-            if (av_interleaved_write_frame(fmt_ctx_, packet_.get()) != 0) {
+            if (write_packet(packet) != 0) {
                 loge("[A] failed to write the packet to the file.");
                 return -1;
             }
@@ -461,41 +728,255 @@ int Encoder::process_audio_frames()
     return ret;
 }
 
+int Encoder::write_packet(av::packet& packet)
+{
+    if (replay_) {
+        replay_->push(packet);
+        return 0;
+    }
+
+    if (mux_failed_) return -1;
+
+    // blocks only if the muxer falls behind by the whole queue
+    return pbuffer_.wait_and_push(std::move(packet)) ? 0 : av::STOPPED;
+}
+
+void Encoder::mux_packets()
+{
+    // exits on the null packet pushed by stop() after all the encoded packets
+    while (true) {
+        max_pbuffer_size_ = std::max(max_pbuffer_size_, pbuffer_.size());
+
+        auto packet = pbuffer_.wait_and_pop();
+        if (!packet || !*packet) break;
+
+        // keep draining after a failure, the encoder must not be blocked by a full queue
+        if (mux_failed_) continue;
+
+        const auto t0 = av::clock::ns();
+
+        const auto pkt = packet->get();
+        const auto itb = fmt_ctx_->streams[pkt->stream_index]->time_base;
+
+        if (segment_start_ == av::clock::nopts) segment_start_ = av::clock::ns(pkt->pts, itb);
+
+        // keep writing the current segment if the next one can not be opened
+        if (should_rotate(pkt)) rotate(av::clock::ns(pkt->pts, itb));
+
+        // each stream is cut at its own first packet at or after the cut point, e.g. the audio packets
+        // queued before the video key frame still belong to the previous segment
+        auto ctx    = octx_;
+        auto offset = segment_offset_;
+        if (prev_octx_ && !cut_[pkt->stream_index]) {
+            if (pkt->pts != AV_NOPTS_VALUE && av::clock::ns(pkt->pts, itb) < segment_start_) {
+                ctx    = prev_octx_;
+                offset = prev_offset_;
+            }
+            else {
+                cut_[pkt->stream_index] = true;
+                if (std::ranges::all_of(cut_, [](const bool cut) { return cut; })) {
+                    finalize_previous_segment();
+                }
+            }
+        }
+
+        if (ctx != fmt_ctx_) {
+            const auto shift = av::clock::to(offset, itb);
+            if (pkt->pts != AV_NOPTS_VALUE) pkt->pts -= shift;
+            if (pkt->dts != AV_NOPTS_VALUE) pkt->dts -= shift;
+            av_packet_rescale_ts(pkt, itb, ctx->streams[pkt->stream_index]->time_base);
+        }
+
+        if (av_interleaved_write_frame(ctx, pkt) != 0) {
+            loge("[     MUXER] failed to write the packet to file.");
+            mux_failed_ = true;
+            continue;
+        }
+
+        const auto elapsed  = av::clock::ns() - t0;
+        muxed_packets_     += 1;
+        mux_time_          += elapsed;
+        max_mux_time_       = std::max(max_mux_time_, elapsed);
+    }
+
+    const auto avg = muxed_packets_ ? mux_time_ / static_cast<int64_t>(muxed_packets_) : 0ns;
+    logi("[     MUXER] muxed packets: {}, max queued: {}, write time avg = {:%T}, max = {:%T}, exited",
+         muxed_packets_, max_pbuffer_size_, avg, max_mux_time_);
+}
+
+bool Encoder::should_rotate(const AVPacket *packet) const
+{
+    if (segment_duration_ <= 0ns && segment_size_ <= 0) return false;
+
+    // at the key frames of the video, or of the audio if there is no video
+    const auto index = vstream_idx_ >= 0 ? vstream_idx_ : astream_idx_;
+    if (packet->stream_index != index || !(packet->flags & AV_PKT_FLAG_KEY)) return false;
+
+    const auto ts = av::clock::ns(packet->pts, fmt_ctx_->streams[index]->time_base);
+
+    return (segment_duration_ > 0ns && ts - segment_start_ >= segment_duration_) ||
+           (segment_size_ > 0 && octx_->pb && avio_tell(octx_->pb) >= segment_size_);
+}
+
+std::string Encoder::next_segment_filename() const
+{
+    using namespace std::chrono;
+
+    const auto now = system_clock::now();
+    const auto ms  = duration_cast<milliseconds>(now.time_since_epoch()).count() % 1000;
+
+    const auto path = std::filesystem::path{ filename_ };
+    const auto time = fmt::localtime(system_clock::to_time_t(now));
+    const auto name = fmt::format("{}{:%Y-%m-%d_%H%M%S}_{:03d}{}", segment_prefix_, time, ms,
+                                  path.extension().string());
+
+    return (path.parent_path() / name).string();
+}
+
+static void finalize_segment(AVFormatContext *ctx, std::unique_ptr<OutputFile> file, const bool owned)
+{
+    if (av_write_trailer(ctx) < 0) loge("[   ENCODER] failed to write trailer");
+
+    if (file && file->close() < 0) loge("[   ENCODER] failed to close the output file.");
+    ctx->pb = nullptr;
+
+    if (owned) avformat_free_context(ctx);
+}
+
+int Encoder::rotate(const std::chrono::nanoseconds ts)
+{
+    const auto filename = next_segment_filename();
+
+    AVFormatContext *ctx = nullptr;
+    if (avformat_alloc_output_context2(&ctx, fmt_ctx_->oformat, nullptr, filename.c_str()) < 0)
+        return av::NOMEM;
+
+    // the same streams as the first segment, the encoders are shared
+    for (unsigned i = 0; i < fmt_ctx_->nb_streams; ++i) {
+        const auto stream = avformat_new_stream(ctx, nullptr);
+        if (!stream || avcodec_parameters_copy(stream->codecpar, fmt_ctx_->streams[i]->codecpar) < 0) {
+            avformat_free_context(ctx);
+            return av::NOMEM;
+        }
+        stream->time_base = fmt_ctx_->streams[i]->time_base;
+    }
+
+    auto file = std::move(ofile_);
+    if (open_output(ctx, filename) < 0) {
+        loge("[   ENCODER] failed to open the segment: {}, continue with the current one", filename);
+        if (ofile_) ofile_->close();
+        avformat_free_context(ctx);
+        ofile_ = std::move(file);
+        return -1;
+    }
+
+    // a stream has not reached the previous cut in a whole segment
+    finalize_previous_segment();
+
+    logi("[   ENCODER] segment {:.3%T} >>> [{}]", ts - segment_start_, filename);
+
+    prev_octx_   = octx_;
+    prev_ofile_  = std::move(file);
+    prev_offset_ = segment_offset_;
+    cut_.assign(fmt_ctx_->nb_streams, false);
+
+    octx_           = ctx;
+    filename_       = filename;
+    segment_start_  = ts;
+    segment_offset_ = ts;
+
+    return 0;
+}
+
+void Encoder::finalize_previous_segment()
+{
+    if (!prev_octx_) return;
+
+    // av_write_trailer() may take long, e.g. the faststart of MP4 rewrites the whole file,
+    // fmt_ctx_ is only freed by close_output_file() since the encoders use the timebases of its streams
+    if (!finalizer_.joinable()) {
+        finalizer_ = std::jthread([this] {
+            probe::thread::set_name("FINALIZER");
+            if (background_) av::lower_thread_priority();
+
+            while (auto segment = finalizing_.wait_and_pop()) {
+                if (!segment->ctx) break;
+
+                finalize_segment(segment->ctx, std::move(segment->file), segment->owned);
+            }
+        });
+    }
+
+    finalizing_.push(segment_t{ prev_octx_, std::move(prev_ofile_), prev_octx_ != fmt_ctx_ });
+
+    prev_octx_ = nullptr;
+}
+
+int Encoder::save_replay(const std::string& filename, std::function<void(int)> done)
+{
+    if (!replay_ || !ready_) return av::UNSUPPORTED;
+
+    return replay_->save(filename, std::move(done));
+}
+
 void Encoder::close_output_file()
 {
     if (!fmt_ctx_) return;
 
-    if (header_written_ && av_write_trailer(fmt_ctx_) < 0) {
-        loge("[   ENCODER] failed to write trailer");
+    // the previous segments
+    finalize_previous_segment();
+    if (finalizer_.joinable()) {
+        finalizing_.push(segment_t{});
+        finalizer_.join();
     }
 
-    if (!(fmt_ctx_->oformat->flags & AVFMT_NOFILE) && avio_closep(&fmt_ctx_->pb) < 0) {
+    if (header_written_ && octx_) {
+        finalize_segment(octx_, std::move(ofile_), octx_ != fmt_ctx_);
+    }
+    else if (ofile_ && ofile_->close() < 0) {
         loge("[   ENCODER] failed to close the output file.");
     }
+    fmt_ctx_->pb = nullptr;
+    octx_        = nullptr;
 
     avcodec_free_context(&vcodec_ctx_);
-    avcodec_free_context(&acodec_ctx_);
+    for (const auto& track : atracks_) {
+        avcodec_free_context(&track->codec);
+    }
     avformat_free_context(fmt_ctx_);
     fmt_ctx_ = nullptr;
 }
 
 void Encoder::stop()
 {
-    asrc_eof_ = true;
+    for (const auto& track : atracks_) {
+        track->src_eof = true;
+    }
     vbuffer_.push(nullptr);
+    notify_all();
 
     // wait <= 3s for draining
     for (int i = 0; (i < 300) && ready() && !eof(); i++) {
         std::this_thread::sleep_for(10ms);
     }
 
-    if (abuffer_) abuffer_->stop();
+    for (const auto& track : atracks_) {
+        if (track->buffer) track->buffer->stop();
+    }
     vbuffer_.stop();
 
     ready_   = false;
     running_ = false;
+    notify_all();
 
     if (thread_.joinable()) thread_.join();
+    if (athread_.joinable()) athread_.join();
+
+    // all packets are queued now, flush them before writing the trailer
+    if (muxer_.joinable()) {
+        pbuffer_.wait_and_push(av::packet{ nullptr });
+        muxer_.join();
+    }
 
     close_output_file();
 
@@ -507,16 +988,23 @@ Encoder::~Encoder()
     vbuffer_.stop();
     vbuffer_.drain();
 
-    if (abuffer_) {
-        abuffer_->stop();
-        abuffer_->drain();
+    for (const auto& track : atracks_) {
+        if (track->buffer) {
+            track->buffer->stop();
+            track->buffer->drain();
+        }
+        track->src_eof = true;
     }
 
-    asrc_eof_ = true;
-    ready_    = false;
-    running_  = false;
+    ready_   = false;
+    running_ = false;
+    notify_all();
 
     if (thread_.joinable()) thread_.join();
+    if (athread_.joinable()) athread_.join();
+
+    pbuffer_.stop();
+    if (muxer_.joinable()) muxer_.join();
 
     close_output_file();
 
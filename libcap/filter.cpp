@@ -3,8 +3,10 @@
 #include "libcap/hwaccel.h"
 #include "logging.h"
 
+#include <algorithm>
 #include <probe/defer.h>
 #include <probe/util.h>
+#include <thread>
 
 extern "C" {
 #include <libavfilter/buffersink.h>
@@ -209,4 +211,17 @@ namespace av::graph
             .time_base   = av_buffersink_get_time_base(sink),
         };
     }
+
+    int default_threads()
+    {
+        return std::clamp<int>(static_cast<int>(std::thread::hardware_concurrency()) / 4, 1, 8);
+    }
+
+    void set_threads(AVFilterGraph *graph, const int threads)
+    {
+        if (!graph) return;
+
+        graph->nb_threads  = threads > 0 ? threads : default_threads();
+        graph->thread_type = AVFILTER_THREAD_SLICE;
+    }
 } // namespace av::graph
\ No newline at end of file
@@ -43,9 +43,12 @@ struct AudioRenderer
 
     [[nodiscard]] virtual av::aformat_t format() const = 0;
 
-    // sample number
+    // sample number, the negotiated one after open()
     [[nodiscard]] virtual uint32_t buffer_size() const = 0;
 
+    // the latency profile, set before open(): ultra-low, normal, power-saving
+    std::string latency{ "normal" };
+
     std::function<uint32_t(uint8_t **data, uint32_t samples, std::chrono::nanoseconds)> callback =
         [](auto, auto, auto) -> int32_t { return 0; };
 };
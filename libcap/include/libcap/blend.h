@@ -0,0 +1,32 @@
+#ifndef CAPTURER_BLEND_H
+#define CAPTURER_BLEND_H
+
+#include <cstdint>
+
+namespace blend
+{
+    // Composite a premultiplied ARGB32 image (e.g. the XFixes cursor image) over a BGR0 / BGR24 image:
+    //
+    //      dst = src + (dst * (255 - a) + 127) / 255
+    //
+    // The 4th byte of the destination pixels is left untouched, as are the pixels with a == 0.
+    //
+    // dst_linesize: in bytes; src_stride: in pixels; pbytes: 3 or 4 bytes per destination pixel
+    void argb_over(uint8_t *dst, int dst_linesize, int pbytes, const uint32_t *src, int src_stride, int w,
+                   int h);
+
+    // the implementations selected by argb_over(), compared against each other by tests/blend-test.cpp
+    void argb_over_c(uint8_t *dst, int dst_linesize, int pbytes, const uint32_t *src, int src_stride, int w,
+                     int h);
+
+#if defined(__x86_64__) || defined(_M_X64)
+    // pbytes == 4 only
+    void argb_over_sse2(uint8_t *dst, int dst_linesize, const uint32_t *src, int src_stride, int w, int h);
+#if defined(__GNUC__) || defined(__clang__)
+    bool has_avx2();
+    void argb_over_avx2(uint8_t *dst, int dst_linesize, const uint32_t *src, int src_stride, int w, int h);
+#endif
+#endif
+} // namespace blend
+
+#endif //! CAPTURER_BLEND_H
@@ -0,0 +1,74 @@
+#ifndef CAPTURER_CHUNKED_ENCODER_H
+#define CAPTURER_CHUNKED_ENCODER_H
+
+#include "media.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Transcodes a file with the video split into segments encoded in parallel, for the slow presets and
+// the encoders whose own threading does not scale to many cores.
+//
+// Each segment is encoded by a separate offline pipeline (MediaReader -> Dispatcher -> Encoder) into a
+// temporary NUT file, starting with a key frame and keeping the source timestamps, the audio is encoded
+// in one piece by another pipeline. The packets are then concatenated into the output without any
+// offset. The segments start at the key frames of the source near the even splits, so few frames are
+// decoded twice, and the encoders of the segments share the same settings, so the codec parameters of
+// the first segment stand for all of them.
+class ChunkedEncoder
+{
+public:
+    // jobs: the segments encoded at the same time, each video encoder gets cores / jobs threads
+    explicit ChunkedEncoder(int jobs);
+
+    // vfmt / afmt / options: of the output, as for Encoder
+    // with the "background" option, all the pipelines and the workers run at a lower priority
+    int run(const std::string& input, const std::string& output, const av::vformat_t& vfmt,
+            const av::aformat_t& afmt, std::map<std::string, std::string> options);
+
+    void cancel() { cancelled_ = true; }
+
+    // [0, 1], of the video segments
+    [[nodiscard]] double progress() const;
+
+    // called on the thread of run() about every 100ms
+    std::function<void(double)> onprogress = [](auto) {};
+
+private:
+    struct segment_t
+    {
+        std::chrono::nanoseconds ss{ av::clock::min };
+        std::chrono::nanoseconds to{ av::clock::max };
+        std::string              filename{};
+
+        std::atomic<int64_t> position{}; // ns encoded
+    };
+
+    // the segments of the video
+    int split(const std::string& input);
+
+    // a segment of the input, video or audio only
+    int encode(const std::string& input, AVMediaType type, segment_t& segment) const;
+
+    int concat(const std::string& output, const std::string& audio) const;
+
+    int jobs_{ 1 };
+
+    av::vformat_t                      vfmt_{};
+    av::aformat_t                      afmt_{};
+    std::map<std::string, std::string> options_{};
+    bool                               background_{};
+
+    std::chrono::nanoseconds duration_{};
+
+    std::vector<std::unique_ptr<segment_t>> segments_{};
+
+    std::atomic<bool> cancelled_{};
+};
+
+#endif //! CAPTURER_CHUNKED_ENCODER_H
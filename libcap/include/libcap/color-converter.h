@@ -0,0 +1,81 @@
+#ifndef CAPTURER_COLOR_CONVERTER_H
+#define CAPTURER_COLOR_CONVERTER_H
+
+#include "ffmpeg-wrapper.h"
+#include "media.h"
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavutil/buffer.h>
+}
+
+// Packed 32-bit RGB to NV12 / YUV420P, used by the dispatcher instead of a filter graph when the
+// video is only converted to the pixel format of the encoder.
+//
+// BT.601 / BT.709 in the full or limited range, fixed point with 14-bit coefficients, the chroma is
+// the average of 2x2 pixels. The frame is split into slices of rows converted in parallel, with SSE2
+// on x86-64 and a scalar loop elsewhere. The output frames are allocated from a buffer pool.
+class ColorConverter
+{
+public:
+    ColorConverter() = default;
+
+    ColorConverter(const ColorConverter&)            = delete;
+    ColorConverter& operator=(const ColorConverter&) = delete;
+
+    ~ColorConverter() { close(); }
+
+    // same size, RGB32 without hardware frames to NV12 / YUV420P, the size of 'out' may be unset
+    static bool supports(const av::vformat_t& in, const av::vformat_t& out);
+
+    // threads: the number of slices converted in parallel, including the calling thread
+    int open(const av::vformat_t& in, const av::vformat_t& out, int threads);
+
+    // the properties of 'in' (pts, side data, etc.) are copied to 'out'
+    int convert(const av::frame& in, av::frame& out);
+
+    void close();
+
+    // the output format, with the color space and range resolved
+    [[nodiscard]] const av::vformat_t& format() const { return ofmt_; }
+
+    [[nodiscard]] int threads() const { return nb_slices_; }
+
+    struct coeffs_t
+    {
+        int16_t y[3]; // r, g, b
+        int16_t u[3];
+        int16_t v[3];
+        int32_t yoff; // offset and rounding, of the 14-bit luma sums
+        int32_t coff; // of the 16-bit chroma sums, i.e. 2x2 pixels
+    };
+
+private:
+    void convert_slice(const AVFrame *in, AVFrame *out, int slice) const;
+
+    void worker_fn(int slice);
+
+    av::vformat_t ifmt_{};
+    av::vformat_t ofmt_{};
+
+    int      shifts_[3]{}; // of the r, g, b components in a little-endian pixel
+    coeffs_t coeffs_{};
+
+    AVBufferPool *pool_{};
+
+    // slice threading @{
+    int                       nb_slices_{ 1 };
+    std::vector<std::jthread> workers_{};
+    const AVFrame            *src_{};
+    AVFrame                  *dst_{};
+    std::atomic<uint64_t>     jobs_{}; // bumped for each frame
+    std::atomic<int>          pending_{};
+    std::atomic<bool>         running_{};
+    //@}
+};
+
+#endif //! CAPTURER_COLOR_CONVERTER_H
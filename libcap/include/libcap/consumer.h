@@ -36,12 +36,19 @@ public:
 
     virtual int consume(const T&, AVMediaType) = 0;
 
+    // separate audio tracks, see audio_tracks, only the first one is consumed by default
+    virtual int consume(const T& frame, AVMediaType type, size_t track)
+    {
+        return track == 0 ? consume(frame, type) : 0;
+    }
+
     [[nodiscard]] virtual bool accepts(AVMediaType) const = 0;
     virtual void               enable(AVMediaType, bool)  = 0;
 
     av::vformat_t vfmt{};
     av::aformat_t afmt{};
     AVRational    input_framerate{ 24, 1 };
+    size_t        audio_tracks{ 1 }; // set by the dispatcher before open(), of the same afmt
 
 protected:
     std::atomic<bool>    ready_{ false };
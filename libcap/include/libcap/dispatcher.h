@@ -1,6 +1,7 @@
 #ifndef CAPTURER_DISPATCHER_H
 #define CAPTURER_DISPATCHER_H
 
+#include "color-converter.h"
 #include "consumer.h"
 #include "ffmpeg-wrapper.h"
 #include "hwaccel.h"
@@ -9,24 +10,98 @@
 #include "queue.h"
 #include "timeline.h"
 
+#include <condition_variable>
+#include <memory>
+#include <mutex>
 #include <set>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 extern "C" {
 #include <libavfilter/avfilter.h>
 }
 
-struct DispatchContext
+// a configured filter graph from the producers to the consumer, or the built-in converter instead
+struct FilterGraph
 {
+    FilterGraph() = default;
+
+    FilterGraph(const FilterGraph&)            = delete;
+    FilterGraph& operator=(const FilterGraph&) = delete;
+
+    ~FilterGraph() { avfilter_graph_free(&graph); }
+
     std::unordered_map<Producer<av::frame> *, AVFilterContext *> srcs{};
     AVFilterContext                                             *sink{};
+    AVFilterGraph                                               *graph{};
+
+    // video only, replaces the graph if it would only convert the pixel format
+    std::unique_ptr<ColorConverter> converter{};
+
+    // video only, the frame size of each input the graph is built for
+    std::unordered_map<Producer<av::frame> *, std::pair<int, int>> sizes{};
+
+    // separate audio tracks, a chain for each producer, sink is the first one @{
+    std::vector<AVFilterContext *>                    sinks{};
+    std::unordered_map<Producer<av::frame> *, size_t> tracks{};
+
+    [[nodiscard]] size_t track(Producer<av::frame> *producer) const
+    {
+        const auto it = tracks.find(producer);
+        return it == tracks.end() ? 0 : it->second;
+    }
+
+    [[nodiscard]] AVFilterContext *sink_of(const size_t track) const
+    {
+        return sinks.empty() ? sink : sinks[track];
+    }
+    //@}
+};
+
+struct DispatchContext
+{
+    // owned by the dispatching thread once started
+    std::unique_ptr<FilterGraph> graph{};
 
     safe_queue<std::pair<av::frame, Producer<av::frame> *>> queue{ 4 };
 
-    AVFilterGraph    *graph{};
-    AVHWDeviceType    hwaccel{ AV_HWDEVICE_TYPE_NONE };
-    std::string       graph_desc{};
-    std::atomic<bool> dirty{};
+    // overflow policy of the queue & number of frames dropped by it
+    av::backpressure_t    backpressure{ av::backpressure_t::block };
+    size_t                capacity{ 4 }; // elastic: the base capacity, shrunk back to once drained
+    size_t                limit{ 64 };   // elastic: the hard cap of the queue
+    std::atomic<uint64_t> dropped{};
+
+    AVHWDeviceType hwaccel{ AV_HWDEVICE_TYPE_NONE };
+    std::string    graph_desc{};
+    int            threads{}; // of the graph / converter, 0 for the default
+
+    // reconfiguration: built on the builder thread, swapped in by the dispatching thread @{
+    std::mutex                   mtx{};
+    std::condition_variable      built{};     // the builder is idle or a graph is pending
+    std::string                  request{};   // the filters of the latest request
+    bool                         requested{}; // not picked up by the builder yet
+    bool                         building{};
+    std::unique_ptr<FilterGraph> pending{};
+    std::string                  pending_desc{};
+    std::atomic<bool>            dirty{};
+    std::mutex                   builder_mtx{}; // of the builder thread object
+    std::jthread                 builder{};
+
+    // video only, the frame sizes of the inputs which differ from their formats, e.g. a resized region
+    std::unordered_map<Producer<av::frame> *, std::pair<int, int>> resized{};
+    //@}
+
+    // by track, EOF has been delivered to the consumer
+    std::vector<bool> eof{};
+
+    // offline mode, the timestamp of the last input frame
+    std::atomic<std::chrono::nanoseconds> position{ av::clock::nopts };
+
+    // filtering time, video only
+    uint64_t                 filtered{};
+    std::chrono::nanoseconds filter_time{};
+    std::chrono::nanoseconds max_filter_time{};
 
     std::atomic<bool> enabled{};
     std::atomic<bool> running{};
@@ -34,6 +109,27 @@ struct DispatchContext
     std::jthread thread;
 };
 
+// a secondary consumer, fed by reference through its own queues
+struct OutputContext
+{
+    Consumer<av::frame> *consumer{};
+
+    av::backpressure_t backpressure{ av::backpressure_t::drop_oldest };
+
+    // one lane for each media type, video drops never affect the audio
+    struct lane_t
+    {
+        safe_queue<av::frame> queue{ 8 };
+        size_t                capacity{ 8 }; // elastic: the base capacity, shrunk back to once drained
+        size_t                limit{ 8 };    // elastic: the hard cap of the queue
+        std::atomic<uint64_t> dropped{};
+        std::jthread          thread;
+    };
+
+    lane_t video{};
+    lane_t audio{};
+};
+
 class Dispatcher
 {
 public:
@@ -41,16 +137,60 @@ public:
 
     ~Dispatcher();
 
+    // offline mode: non-realtime producers only (e.g. files), realtime ones otherwise
     int add_input(Producer<av::frame> *decoder);
 
+    // offline mode, must be set before adding the inputs
+    // the frames are never dropped, the producers are blocked until the consumer catches up, and the
+    // source timestamps are kept, so the input is processed as fast as the consumer can encode it
+    int set_offline(bool offline);
+
+    [[nodiscard]] bool offline() const { return offline_; }
+
+    // must be set before initialize(), each audio producer is delivered as a separate track of the
+    // consumer in the order of the inputs instead of being mixed by the audio filters, which are ignored
+    // the secondary consumers only receive the first track
+    int set_separate_audio_tracks(bool separate);
+
+    // the primary consumer, frames are delivered synchronously by the dispatching threads
     void set_output(Consumer<av::frame> *encoder);
 
+    // secondary consumers, e.g. live preview, proxy recording or replay buffer
+    // they share the output format of the primary consumer, and a slow one only drops its own frames
+    // with separate audio tracks, they only receive the first track, i.e. the first audio input
+    int add_output(Consumer<av::frame> *consumer,
+                   av::backpressure_t   backpressure = av::backpressure_t::drop_oldest);
+
     void set_hwaccel(AVHWDeviceType);
 
+    // slice threads of the video filter graph or the built-in converter, 0 for the default
+    void set_filter_threads(int threads);
+
+    // background jobs, e.g. transcoding: the dispatching threads run at a lower priority, must be set
+    // before start()
+    void set_background(bool background);
+
+    // capacity: the queue size, 0 to keep the current one
+    // limit   : elastic only, the queue grows up to it before any frame is dropped, 0 for 16 x capacity,
+    //           and shrinks back to the capacity once the consumer has caught up
+    void set_backpressure(AVMediaType, av::backpressure_t, size_t capacity = 0, size_t limit = 0);
+
+    [[nodiscard]] uint64_t dropped(AVMediaType) const;
+
     int initialize(const std::string_view& video_filters, const std::string_view& audio_filters);
 
+    // rebuild the filter graph with the new filters and the current formats of the producers while running
+    // the graph is built on a helper thread and swapped in before the next frame, the old one is drained
+    // returns at once, the requests made during a rebuild are merged into one with the latest filters
+    // the frame size of the consumer can not change, the output is scaled to it if necessary
+    // also called by the dispatching thread when the frame size of a video input changes, e.g. the region
+    // of a screen capturer or the resolution of a file, the frames are dropped until the graph is swapped
+    // in, or waited for in offline mode
+    int reconfigure(AVMediaType type, const std::string_view& filters);
+
     int start();
 
+    // ignored in offline mode
     void pause();
     void resume();
 
@@ -58,15 +198,47 @@ public:
 
     [[nodiscard]] bool running() const { return vctx_.running || actx_.running; }
 
+    // offline mode: the timestamp of the last input frame
     [[nodiscard]] std::chrono::nanoseconds escaped() const;
 
 private:
-    int create_filter_graph(AVMediaType);
+    int create_filter_graph(AVMediaType, const std::string& desc, FilterGraph& fg);
+
+    // the built-in converter instead of a filter graph, returns false if it is not applicable
+    bool create_converter(const std::string& desc, FilterGraph& fg);
+
+    // swap the rebuilt graph in, called by the dispatching thread between frames
+    void swap_filter_graph(AVMediaType mt, av::frame& frame);
+
+    // the format of the video input, with the size of its frames if it has been resized
+    av::vformat_t input_vformat(Producer<av::frame> *producer);
+
+    // the frame does not fit the graph: 0 if it does (again), AGAIN to drop it, or an error
+    int check_input_size(Producer<av::frame> *producer, const av::frame& frame);
+
+    // a buffersrc -> buffersink chain for each audio producer
+    int create_audio_tracks(const std::string& desc, FilterGraph& fg);
+
+    // deliver the frames available in the sink of the track, returns EAGAIN, EOF or an error
+    int pull_frames(DispatchContext& ctx, AVMediaType mt, av::frame& frame, size_t track = 0);
 
     int update_encoder_format_by_sinks();
 
     int dispatch_fn(AVMediaType mt);
 
+    void enqueue(AVMediaType mt, const av::frame& frame, Producer<av::frame> *producer);
+
+    void deliver(const av::frame& frame, AVMediaType mt, size_t track = 0);
+
+    // EOF to the track, once
+    void deliver_eof(AVMediaType mt, size_t track);
+    // EOF to all the tracks which have not received it yet
+    void deliver_eof(AVMediaType mt);
+
+    static void update_filter_time(DispatchContext& ctx, std::chrono::nanoseconds elapsed);
+
+    void output_fn(OutputContext *output, AVMediaType mt);
+
     // clock @{
     std::chrono::nanoseconds start_time_{ av::clock::nopts };
     av::timeline_t           timeline_{};
@@ -75,7 +247,16 @@ private:
     std::set<Producer<av::frame> *> producers_{};
     Consumer<av::frame>            *consumer_{};
 
+    // separate audio tracks, the audio producers in the order of add_input() @{
+    bool                               separate_audio_{};
+    std::vector<Producer<av::frame> *> audio_inputs_{};
+    //@}
+
+    std::vector<std::unique_ptr<OutputContext>> outputs_{};
+
     std::atomic<bool> ready_{};
+    bool              offline_{};
+    bool              background_{};
 
     DispatchContext vctx_{};
     DispatchContext actx_{};
@@ -2,10 +2,19 @@
 #define CAPTURER_ENCODER_H
 
 #include "audio-fifo.h"
+#include "clock.h"
 #include "consumer.h"
 #include "ffmpeg-wrapper.h"
 #include "logging.h"
+#include "output-file.h"
+#include "quality-governor.h"
 #include "queue.h"
+#include "replay-buffer.h"
+#include "spsc-queue.h"
+
+#include <array>
+#include <functional>
+#include <vector>
 
 extern "C" {
 #include <libavcodec/avcodec.h>
@@ -33,6 +42,9 @@ public:
 
     int consume(const av::frame& frame, AVMediaType type) override;
 
+    // a stream is created for each of the audio_tracks
+    int consume(const av::frame& frame, AVMediaType type, size_t track) override;
+
     bool accepts(AVMediaType type) const override;
 
     void enable(AVMediaType type, bool v) override;
@@ -42,50 +54,160 @@ public:
         return (vstream_idx_ < 0 || eof_ & V_ENCODING_EOF) && (astream_idx_ < 0 || eof_ & A_ENCODING_EOF);
     }
 
+    // replay mode: the packets are only buffered in memory and written to the file on demand
+    bool replaying() const { return replay_ != nullptr; }
+
+    // done: called with the result when the file has been written, on the saving thread
+    int save_replay(const std::string& filename, std::function<void(int)> done = {});
+
 private:
+    // an audio stream with its own encoder and fifo, so that the tracks never wait for each other
+    struct audio_track_t
+    {
+        int                              stream_idx{ -1 };
+        AVCodecContext                  *codec{};
+        std::unique_ptr<safe_audio_fifo> buffer{};
+        std::atomic<bool>                src_eof{};
+        bool                             eof{};
+
+        int64_t    pts{ 0 }; // of the end of the buffer
+        int64_t    last_dts{ AV_NOPTS_VALUE };
+        av::packet packet{};
+
+        // pre-allocated audio frames, av_frame_make_writable() before reuse
+        std::array<av::frame, 4> frames{};
+        size_t                   frame_idx{};
+
+        [[nodiscard]] bool ready() const
+        {
+            return !eof && (buffer->size() >= codec->frame_size || src_eof);
+        }
+    };
+
     int new_video_stream(const std::string& codec_name);
     int new_audio_stream(const std::string& codec_name);
 
+    // open the file of the context and write the header, the file becomes ofile_
+    int open_output(AVFormatContext *ctx, const std::string& filename);
+
+    // the muxer options of the fragmented output, by the output format
+    void set_fragment_options(AVFormatContext *ctx, AVDictionary **options);
+
+    // rotation: the packet starts a new segment
+    [[nodiscard]] bool should_rotate(const AVPacket *packet) const;
+    int                rotate(std::chrono::nanoseconds ts);
+    std::string        next_segment_filename() const;
+    // hand the previous segment over to the finalizer thread
+    void               finalize_previous_segment();
+
+    // wake up the encoding thread of the media type
+    void notify(AVMediaType type);
+    void notify_all();
+
+    bool audio_ready() const;
+
     std::pair<int, int> video_sync_process(av::frame& frame);
     int                 process_video_frames();
+    void                adapt_quality(std::chrono::nanoseconds elapsed);
     int                 process_audio_frames();
+    int                 process_audio_frames(audio_track_t& track);
+    int                 write_packet(av::packet& packet);
+    void                mux_packets();
     void                close_output_file();
 
     int               vstream_idx_{ -1 };
-    int               astream_idx_{ -1 };
+    int               astream_idx_{ -1 }; // of the first audio track
     std::atomic<bool> video_enabled_{ false };
     std::atomic<bool> audio_enabled_{ false };
 
     std::atomic<bool> header_written_{ false };
 
     int         crf_{ -1 };
+    std::string threads_{ "auto" }; // of the video encoder
     std::string preset_{};
     std::string profile_{};
     std::string tune_{};
 
+    std::chrono::nanoseconds fragment_duration_{}; // 0: not fragmented
+
     // ffmpeg encoders @ {
     AVFormatContext *fmt_ctx_{};
     AVCodecContext  *vcodec_ctx_{};
-    AVCodecContext  *acodec_ctx_{};
     // @}
 
-    std::jthread thread_{};
+    std::vector<std::unique_ptr<audio_track_t>> atracks_{};
+
+    std::jthread thread_{};  // video
+    std::jthread athread_{}; // audio
+
+    // bumped on every new input (video frame, a full audio frame, EOF), the encoders wait on them
+    std::atomic<uint64_t> vevents_{ 0 };
+    std::atomic<uint64_t> aevents_{ 0 };
+
+    // muxer @ {
+    std::unique_ptr<OutputFile> ofile_{}; // of the current segment
+    OutputFile::options_t       ofile_options_{};
+    safe_queue<av::packet>      pbuffer_{ 512 };
+    std::jthread                muxer_{};
+    std::atomic<bool>           mux_failed_{ false };
+    size_t                      max_pbuffer_size_{};
+    uint64_t                    muxed_packets_{};
+    std::chrono::nanoseconds    mux_time_{};
+    std::chrono::nanoseconds    max_mux_time_{};
+    // @}
+
+    // rotation, only the muxer thread switches the segments @{
+    std::chrono::nanoseconds segment_duration_{}; // 0: disabled
+    int64_t                  segment_size_{};     // bytes, 0: disabled
+    std::string              segment_prefix_{};
+    std::string              filename_{};
+    // the current segment, fmt_ctx_ at first, whose streams keep the timebases of the encoders
+    AVFormatContext         *octx_{};
+    // in the timeline of fmt_ctx_, the start of the current segment is its zero
+    std::chrono::nanoseconds segment_start_{ av::clock::nopts };
+    std::chrono::nanoseconds segment_offset_{};
+    // the previous segment is kept open until every stream has reached the cut, so that the packets of a
+    // stream queued before the key frame are still written to it instead of starting the next one early
+    AVFormatContext            *prev_octx_{};
+    std::unique_ptr<OutputFile> prev_ofile_{};
+    std::chrono::nanoseconds    prev_offset_{};
+    std::vector<bool>           cut_{}; // by the stream index
+    // the trailers of the previous segments are written one by one, a null context stops it
+    struct segment_t
+    {
+        AVFormatContext            *ctx{};
+        std::unique_ptr<OutputFile> file{};
+        bool                        owned{};
+    };
+    safe_queue<segment_t> finalizing_{};
+    std::jthread          finalizer_{};
+    //@}
 
     int64_t v_last_dts_{ AV_NOPTS_VALUE };
-    int64_t a_last_dts_{ AV_NOPTS_VALUE };
-    int64_t audio_pts_{ 0 };
 
-    av::packet packet_{};
+    av::packet vpacket_{};
     av::frame  last_frame_{};
 
     // the expected pts of next video frame computed by last pts and duration
     int64_t expected_pts_{ AV_NOPTS_VALUE };
 
-    std::atomic<bool>                asrc_eof_{};
-    std::unique_ptr<safe_audio_fifo> abuffer_{};
-    safe_queue<av::frame>            vbuffer_{ 8 };
+    spsc_queue<av::frame> vbuffer_{ 8 };
 
     av::vsync_t vsync_{ av::vsync_t::cfr };
+
+    // the audio input is blocked instead of dropped when the buffer is full
+    bool offline_{};
+
+    // the threads run at a lower priority
+    bool background_{};
+
+    // adaptive quality, realtime only @{
+    bool                             adaptive_{};
+    std::unique_ptr<QualityGovernor> governor_{};
+    uint64_t                         vinputs_{}; // input video frames, for the decimation
+    //@}
+
+    std::unique_ptr<ReplayBuffer> replay_{};
 };
 
 #endif //! CAPTURER_ENCODER_H
@@ -19,6 +19,12 @@ namespace av::graph
 
     av::vformat_t buffersink_get_video_format(const AVFilterContext *sink);
     av::aformat_t buffersink_get_audio_format(const AVFilterContext *sink);
+
+    // the default of the slice threads of a graph, a share of the cores left by the encoder / decoder
+    int default_threads();
+
+    // slice threading of the filters, e.g. scale / format / paletteuse, 0 for the default
+    void set_threads(AVFilterGraph *graph, int threads);
 } // namespace av::graph
 
 #endif //! CAPTURER_FILTER_H
\ No newline at end of file
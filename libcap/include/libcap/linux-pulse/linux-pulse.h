@@ -44,6 +44,13 @@ namespace pulse
     AVSampleFormat to_av_sample_format(pa_sample_format_t pa_fmt);
 
     uint64_t to_av_channel_layout(uint8_t channels);
+
+    // the buffer attributes of the latency profiles, requested with PA_STREAM_ADJUST_LATENCY:
+    //  ultra-low   : ~10ms, live streaming & monitoring
+    //  normal      : ~25ms
+    //  power-saving: ~200ms, long recordings, fewer wakeups
+    pa_buffer_attr record_buffer_attr(const std::string& latency, const pa_sample_spec *spec);
+    pa_buffer_attr playback_buffer_attr(const std::string& latency, const pa_sample_spec *spec);
 } // namespace pulse
 
 namespace pulse
@@ -4,6 +4,9 @@
 #include "libcap/ffmpeg-wrapper.h"
 #include "libcap/producer.h"
 #include "libcap/queue.h"
+#include "libcap/spsc-queue.h"
+
+#include <thread>
 
 extern "C" {
 #include <pulse/pulseaudio.h>
@@ -29,14 +32,57 @@ public:
     std::vector<av::aformat_t> audio_formats() const override { return { afmt }; }
 
 private:
+    // a chunk of samples in the ring
+    struct chunk_t
+    {
+        int64_t pts{};
+        size_t  offset{};
+        size_t  bytes{};
+        size_t  dropped{};  // bytes dropped before this chunk, the ring or the queue was full
+        double  resynced{}; // ns, the error when the clock was re-anchored
+        double  drift{};    // ppm, of the sound card clock, by the PLL on the mainloop
+    };
+
+    static void pulse_stream_state_callback(pa_stream *, void *);
     static void pulse_stream_read_callback(pa_stream *, size_t, void *);
 
+    // the capture time of the next chunk
+    int64_t timestamp(int64_t nb_samples);
+
+    // mainloop thread: copies the samples to the ring, no allocation, no blocking
+    void push(const void *data, size_t bytes, int64_t pts);
+
+    // worker thread: builds the frames
+    void run();
+
     av::frame frame_{};
     size_t    bytes_per_frame_{ 1 };
     size_t    frame_number_{ 0 };
 
+    // drift-compensated clock, mainloop only, the worker gets it by the chunks @{
+    uint64_t samples_{};        // captured since the stream started
+    double   next_pts_{};       // ns, the filtered capture time of the next sample
+    double   period_{};         // ns per sample, follows the drift of the sound card
+    double   nominal_period_{}; // ns per sample, by the sample rate
+    double   resynced_{};
+    //@}
+
+    // the samples are copied to the ring on the mainloop, and built into pooled frames on the worker @{
+    std::unique_ptr<uint8_t[]> ring_{};
+    size_t                     ring_size_{};
+    size_t                     ring_write_{}; // bytes written, the mainloop only
+    std::atomic<size_t>        ring_read_{};  // bytes released by the worker
+    size_t                     dropped_{};
+    spsc_queue<chunk_t>        chunks_{ 256 };
+    AVBufferPool              *pool_{};
+    size_t                     pool_size_{};
+    uint32_t                   fragsize_{}; // bytes, negotiated with the server
+    std::jthread               thread_{};
+    //@}
+
     // pulse audio @{
-    pa_stream *stream_{};
+    pa_stream  *stream_{};
+    std::string latency_{ "normal" };
     // @}
 };
 
@@ -36,7 +36,7 @@ public:
 
     [[nodiscard]] av::aformat_t format() const override { return format_; }
 
-    [[nodiscard]] uint32_t buffer_size() const override { return buffer_attrs_.tlength; }
+    [[nodiscard]] uint32_t buffer_size() const override { return buffer_attrs_.tlength / bytes_per_frame_; }
 
 private:
     static void pulse_stream_success_callback(pa_stream *, int success, void *);
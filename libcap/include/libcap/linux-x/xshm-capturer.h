@@ -6,8 +6,14 @@
 #include "libcap/ffmpeg-wrapper.h"
 #include "libcap/screen-capturer.h"
 
+#include <chrono>
+#include <deque>
 #include <thread>
+#include <vector>
+#include <xcb/damage.h>
+#include <xcb/shm.h>
 #include <xcb/xcb.h>
+#include <xcb/xfixes.h>
 
 class XshmCapturer final : public ScreenCapturer
 {
@@ -21,7 +27,26 @@ public:
     void stop() override;
 
 private:
-    int xfixes_draw_cursor(av::frame& frame) const;
+    // pipelined grabbing: request() sends a SHM GetImage for the tick, complete() waits for the oldest
+    // request, composites the cursor and dispatches the frame
+    int  request(std::chrono::nanoseconds pts, std::vector<xcb_rectangle_t>& rects);
+    int  complete();
+    void discard_requests();
+
+    // refresh the cached cursor image after CursorNotify, otherwise only query the position
+    void update_cursor();
+    void xfixes_draw_cursor(av::frame& frame, int16_t px, int16_t py);
+
+    // XDamage: re-emit the last frame if neither the screen nor the cursor has changed
+    int  xdamage_init();
+    void xdamage_release();
+    void poll_events();
+    bool changed() const;
+    // fetch and clear the damaged rectangles, in the coordinates of the frame
+    void fetch_damage(std::vector<xcb_rectangle_t>& rects);
+
+    // the time from the deadline of the tick to handing the frame off
+    void update_latency(std::chrono::nanoseconds deadline);
 
     xcb_connection_t *conn_{};
     xcb_screen_t     *screen_{};
@@ -30,6 +55,53 @@ private:
     int               bpp_{};
     size_t            frame_size_{};
 
+    struct request_t
+    {
+        AVBufferRef                 *buf{};
+        xcb_shm_get_image_cookie_t   cookie{};
+        std::chrono::nanoseconds     pts{};
+        std::vector<xcb_rectangle_t> rects{};
+        bool                         cursor_changed{};
+        int16_t                      cursor_x{}; // the cursor position at the time of the request
+        int16_t                      cursor_y{};
+    };
+
+    size_t                pipeline_depth_{ 2 };
+    std::deque<request_t> requests_{};
+
+    // cursor @ {
+    struct cursor_t
+    {
+        std::vector<uint32_t> image{}; // premultiplied ARGB
+        uint16_t              width{};
+        uint16_t              height{};
+        uint16_t              xhot{};
+        uint16_t              yhot{};
+    } cursor_{};
+
+    uint8_t         xfixes_event_{};
+    bool            cursor_dirty_{ true }; // the cached image is stale
+    bool            cursor_changed_{ true };
+    int16_t         cursor_x_{ -1 };
+    int16_t         cursor_y_{ -1 };
+    xcb_rectangle_t cursor_rect_{}; // where the cursor was drawn in the last frame
+    // @}
+
+    // XDamage @ {
+    xcb_damage_damage_t damage_{};
+    xcb_xfixes_region_t region_{};
+    uint8_t             damage_event_{};
+    bool                damaged_{ true };
+    av::frame           last_frame_{ nullptr };
+    // @}
+
+    // pacing statistics @ {
+    uint64_t                 frames_{};
+    uint64_t                 overruns_{}; // skipped ticks
+    std::chrono::nanoseconds latency_{};
+    std::chrono::nanoseconds max_latency_{};
+    // @}
+
     std::jthread thread_{};
 };
 
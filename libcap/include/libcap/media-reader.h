@@ -0,0 +1,84 @@
+#ifndef CAPTURER_MEDIA_READER_H
+#define CAPTURER_MEDIA_READER_H
+
+#include "ffmpeg-wrapper.h"
+#include "producer.h"
+
+#include <thread>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+// A file-backed producer, not realtime: the best video and audio streams are decoded as fast as they
+// are taken, with the source timestamps, e.g. to transcode a recording by an offline dispatcher.
+// The frames are software frames, an EOF (nullptr) is sent for each stream at the end of the file.
+//
+// options:
+//   ss / to: seconds, only the frames in [ss, to) of the source timeline are produced, the decoding
+//            starts at the key frame before ss
+//   background: "1" / "true", the reading thread runs at a lower priority, see av::lower_thread_priority()
+class MediaReader final : public Producer<av::frame>
+{
+public:
+    MediaReader() = default;
+
+    ~MediaReader() override;
+
+    std::string name() const override { return name_; }
+
+    int open(const std::string& filename, std::map<std::string, std::string> options) override;
+
+    int start() override;
+
+    void stop() override;
+
+    // must be called before open(), a disabled stream is not decoded
+    void enable(AVMediaType type, bool v) override;
+
+    [[nodiscard]] bool has(AVMediaType type) const override;
+
+    [[nodiscard]] bool is_realtime() const override { return false; }
+
+    [[nodiscard]] std::chrono::nanoseconds duration() const override;
+
+    [[nodiscard]] std::vector<av::vformat_t> video_formats() const override { return { vfmt }; }
+    [[nodiscard]] std::vector<av::aformat_t> audio_formats() const override { return { afmt }; }
+
+private:
+    int open_decoder(AVMediaType type);
+
+    // packet: nullptr to flush
+    int decode(AVCodecContext *codec, const AVPacket *packet, AVMediaType type);
+
+    // the enabled streams have passed the end of the range
+    [[nodiscard]] bool ended() const;
+
+    void read_fn();
+
+    std::string name_{};
+
+    AVFormatContext *fmt_ctx_{};
+    AVCodecContext  *vcodec_ctx_{};
+    AVCodecContext  *acodec_ctx_{};
+    int              vstream_idx_{ -1 };
+    int              astream_idx_{ -1 };
+    bool             venabled_{ true };
+    bool             aenabled_{ true };
+
+    // range @{
+    std::chrono::nanoseconds ss_{ av::clock::min };
+    std::chrono::nanoseconds to_{ av::clock::max };
+    bool                     vended_{};
+    bool                     aended_{};
+    //@}
+
+    bool background_{};
+
+    av::frame frame_{};
+
+    std::jthread thread_{};
+};
+
+#endif //! CAPTURER_MEDIA_READER_H
@@ -25,6 +25,15 @@ namespace av
         vfr,
     };
 
+    // what a producer does when the queue it delivers frames to is full
+    enum class backpressure_t
+    {
+        block,       // wait until there is room
+        drop_oldest, // evict the oldest queued frame
+        drop_newest, // drop the arriving frame
+        elastic,     // never block, use a larger buffer and evict the oldest one as a last resort
+    };
+
     enum status_t : int
     {
         OK = 0,
@@ -247,6 +256,26 @@ namespace av
         }
     }
 
+    inline std::string to_string(const backpressure_t bp)
+    {
+        switch (bp) {
+        case backpressure_t::block:       return "block";
+        case backpressure_t::drop_oldest: return "drop-oldest";
+        case backpressure_t::drop_newest: return "drop-newest";
+        case backpressure_t::elastic:     return "elastic";
+        default:                          return "unknown";
+        }
+    }
+
+    inline backpressure_t to_backpressure(const std::string& str)
+    {
+        if (str == "drop-oldest") return backpressure_t::drop_oldest;
+        if (str == "drop-newest") return backpressure_t::drop_newest;
+        if (str == "elastic") return backpressure_t::elastic;
+
+        return backpressure_t::block;
+    }
+
     inline vsync_t to_vsync(const std::string& str)
     {
         if (str == "vfr" || str == "VFR") return vsync_t::vfr;
@@ -0,0 +1,70 @@
+#ifndef CAPTURER_OUTPUT_FILE_H
+#define CAPTURER_OUTPUT_FILE_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+extern "C" {
+#include <libavformat/avio.h>
+}
+
+// Output file behind a custom AVIOContext, used instead of avio_open() so that the muxer writes
+// through a large buffer and the file can be opened with O_DIRECT and preallocated.
+//
+// On the platforms other than Linux the file is opened by avio_open() unbuffered, behind the same
+// buffer of the requested size.
+class OutputFile
+{
+public:
+    struct options_t
+    {
+        size_t  buffer_size{ 4 * 1024 * 1024 }; // bytes, rounded up to the alignment of direct I/O
+        bool    direct{ false };                // O_DIRECT for the aligned writes, if supported
+        int64_t preallocate{ 0 };               // bytes reserved by fallocate(), 0 to disable
+    };
+
+    OutputFile() = default;
+
+    OutputFile(const OutputFile&)            = delete;
+    OutputFile& operator=(const OutputFile&) = delete;
+
+    ~OutputFile() { close(); }
+
+    int open(const std::string& filename, const options_t& options);
+
+    [[nodiscard]] AVIOContext *context() const { return pb_; }
+
+    // flush the buffer, release the unused preallocated space and close the file
+    int close();
+
+private:
+#if LIBAVFORMAT_VERSION_MAJOR < 61
+    static int write(void *opaque, uint8_t *buf, int size);
+#else
+    static int write(void *opaque, const uint8_t *buf, int size);
+#endif
+    static int64_t seek(void *opaque, int64_t offset, int whence);
+
+#ifdef __linux__
+    int      fd_{ -1 };
+    int      direct_fd_{ -1 };
+    uint8_t *aligned_{}; // staging buffer for O_DIRECT
+    int64_t  pos_{};
+    int64_t  size_{};
+#else
+    AVIOContext *file_{}; // opened with AVIO_FLAG_DIRECT, pb_ is the only buffer
+#endif
+
+    size_t       buffer_size_{};
+    AVIOContext *pb_{};
+    std::string  filename_{};
+
+    // metrics
+    uint64_t                 writes_{};
+    uint64_t                 bytes_{};
+    std::chrono::nanoseconds write_time_{};
+    std::chrono::nanoseconds max_write_time_{};
+};
+
+#endif //! CAPTURER_OUTPUT_FILE_H
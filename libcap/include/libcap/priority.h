@@ -0,0 +1,13 @@
+#ifndef CAPTURER_PRIORITY_H
+#define CAPTURER_PRIORITY_H
+
+namespace av
+{
+    // lower the CPU and I/O priorities of the calling thread until it exits, for the background jobs,
+    // e.g. transcoding, so that they never take the cores from the UI or a live recording
+    // the priority class of the process is never changed, the threads created by the calling thread
+    // inherit the nice value on Linux, but keep the normal priority on Windows
+    void lower_thread_priority();
+} // namespace av
+
+#endif //! CAPTURER_PRIORITY_H
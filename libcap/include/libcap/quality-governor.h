@@ -0,0 +1,53 @@
+#ifndef CAPTURER_QUALITY_GOVERNOR_H
+#define CAPTURER_QUALITY_GOVERNOR_H
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+
+// Steps the cost of the video encoding down when the encoder falls behind, and back up when it has
+// headroom again, before the frames pile up in the input queue and are dropped.
+//
+// Fed by the encoding thread with the time spent on each input frame and the depth of the input queue.
+// The load is the smoothed encoding time over the input frame interval. The encoder steps down if the
+// queue is half full or the load is above 90%, at most once a second, and steps up if the load at the
+// upper level is estimated below 70% with an empty queue for 5 seconds.
+class QualityGovernor
+{
+public:
+    struct level_t
+    {
+        int crf;        // added to the CRF, if the encoder can be reconfigured on the fly
+        int decimation; // 1 of every N input frames is encoded, the CFR sync duplicates the others
+    };
+
+    static constexpr std::array<level_t, 4> levels{ {
+        { 0, 1 },
+        { 4, 1 },
+        { 4, 2 },
+        { 8, 3 },
+    } };
+
+    // interval: of the input frames
+    explicit QualityGovernor(std::chrono::nanoseconds interval);
+
+    // returns true if the level has been changed
+    bool update(std::chrono::nanoseconds elapsed, size_t depth, size_t capacity);
+
+    [[nodiscard]] size_t level() const { return level_; }
+
+    [[nodiscard]] const level_t& current() const { return levels[level_]; }
+
+    [[nodiscard]] double load() const { return load_; }
+
+private:
+    std::chrono::nanoseconds interval_;
+
+    size_t level_{};
+    double load_{};
+
+    std::chrono::nanoseconds changed_at_{};     // the last transition
+    std::chrono::nanoseconds headroom_since_{}; // 0: no headroom
+};
+
+#endif //! CAPTURER_QUALITY_GOVERNOR_H
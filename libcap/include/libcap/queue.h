@@ -184,6 +184,37 @@ public:
         return true;
     }
 
+    // push the value, evicting the oldest element if the queue is full
+    // returns the evicted element, so that it can be released outside the lock
+    std::optional<value_type> evict_and_push(value_type&& value)
+    {
+        std::optional<value_type> evicted{};
+
+        std::lock_guard lock(mtx_);
+
+        if (stopped_) return std::nullopt;
+
+        if (buffer_.size() >= capacity_) {
+            evicted = std::move(buffer_.front());
+            buffer_.pop();
+        }
+
+        buffer_.push(std::move(value));
+
+        nonempty_.notify_one();
+
+        return evicted;
+    }
+
+    void reserve(const size_t capacity)
+    {
+        std::lock_guard lock(mtx_);
+
+        capacity_ = capacity;
+
+        nonfull_.notify_all();
+    }
+
     void drain()
     {
         std::lock_guard lock(mtx_);
@@ -0,0 +1,88 @@
+#ifndef CAPTURER_REPLAY_BUFFER_H
+#define CAPTURER_REPLAY_BUFFER_H
+
+#include "clock.h"
+#include "ffmpeg-wrapper.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+// Keeps the last N seconds / N bytes of encoded packets in memory and muxes them to a file on demand.
+//
+// Packets are grouped by GOP: a group starts at a video key frame (or at any key packet if there is
+// no video stream) and owns every packet that follows it, so eviction always drops whole GOPs and a
+// saved file always begins with a decodable key frame. The packets are reference-counted, saving
+// takes a snapshot of the references and muxes it on a background thread.
+class ReplayBuffer
+{
+public:
+    // duration / size: the limits of the buffered packets, 0 for unlimited
+    ReplayBuffer(std::chrono::nanoseconds duration, size_t size);
+
+    ReplayBuffer(const ReplayBuffer&)            = delete;
+    ReplayBuffer& operator=(const ReplayBuffer&) = delete;
+
+    ~ReplayBuffer();
+
+    // copy the codec parameters and time bases of the output streams
+    int open(const AVFormatContext *fmt_ctx);
+
+    // the timestamps of the packet must be in the time base of its stream
+    void push(const av::packet& packet);
+
+    // mux the buffered packets into the file asynchronously
+    // done: called by the saving thread with the result once the file is complete or failed
+    int save(const std::string& filename, std::function<void(int)> done = {});
+
+    bool saving() const { return saving_; }
+
+    // bytes currently held by the buffered packets
+    size_t size() const;
+
+    std::chrono::nanoseconds duration() const;
+
+private:
+    struct gop_t
+    {
+        std::vector<av::packet>  packets{};
+        size_t                   bytes{};
+        std::chrono::nanoseconds start{ av::clock::nopts };
+    };
+
+    struct stream_t
+    {
+        AVCodecParameters *codecpar{};
+        AVRational         time_base{};
+    };
+
+    void evict();
+
+    int mux(const std::string& filename, const std::vector<av::packet>& packets,
+            std::chrono::nanoseconds offset) const;
+
+    const std::chrono::nanoseconds max_duration_;
+    const size_t                   max_size_;
+
+    std::vector<stream_t> streams_{};
+    int                   vstream_idx_{ -1 };
+
+    mutable std::mutex       mtx_{};
+    std::deque<gop_t>        gops_{};
+    size_t                   bytes_{};
+    std::chrono::nanoseconds last_ts_{ av::clock::nopts };
+
+    std::atomic<bool> saving_{ false };
+    std::jthread      saver_{};
+};
+
+#endif //! CAPTURER_REPLAY_BUFFER_H
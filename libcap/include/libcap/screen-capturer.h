@@ -26,6 +26,8 @@ public:
     // 5.
     int      level{ CAPTURE_DESKTOP };
     uint64_t handle{}; // Windows: HMONITOR or HWND; Linux: X11 Window
+    // 6. reuse the last frame while nothing on the screen changes, if supported
+    bool     track_damage{ true };
 };
 
 #endif //! CAPTURER_SCREENCAPTURER_H
@@ -0,0 +1,235 @@
+#ifndef CAPTURER_SPSC_QUEUE_H
+#define CAPTURER_SPSC_QUEUE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+
+// Bounded lock-free ring buffer for single-producer / single-consumer hops, a drop-in alternative
+// to safe_queue on the frame hot paths.
+//
+// The uncontended push / pop is a couple of atomic loads and stores. The blocking variants park
+// on std::atomic::wait (a futex on Linux), and the other side only issues a wake-up when there is
+// a parked waiter, so no syscall is made unless one of the sides actually has to sleep.
+//
+// Only one thread may push. Elements are claimed by CAS on the read index and released through a
+// per-slot sequence number, so besides the consumer, drain() / stop() from a control thread and
+// push(..., discard = true) from the producer may remove elements safely.
+template<class T> class spsc_queue
+{
+public:
+    using value_type      = T;
+    using reference       = T&;
+    using const_reference = const T&;
+
+    spsc_queue(const spsc_queue&)            = delete;
+    spsc_queue& operator=(const spsc_queue&) = delete;
+
+    explicit spsc_queue(const size_t capacity)
+        : capacity_(std::max<size_t>(capacity, 1)),
+          slots_(std::make_unique<slot_t[]>(capacity_))
+    {
+        for (size_t i = 0; i < capacity_; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // capacity
+
+    [[nodiscard]] bool empty() const noexcept { return size() == 0; }
+
+    [[nodiscard]] size_t size() const noexcept
+    {
+        const auto head = head_.load(std::memory_order_acquire);
+        const auto tail = tail_.load(std::memory_order_acquire);
+        return tail > head ? tail - head : 0;
+    }
+
+    [[nodiscard]] size_t capacity() const noexcept { return capacity_; }
+
+    [[nodiscard]] bool stopped() const noexcept { return stopped_.load(std::memory_order_acquire); }
+
+    // modifiers
+
+    [[nodiscard]] std::optional<value_type> wait_and_pop()
+    {
+        while (!stopped()) {
+            if (auto value = try_pop(); value) return value;
+
+            park(readable_, pop_waiters_, [this] { return stopped() || !empty(); });
+        }
+
+        return std::nullopt;
+    }
+
+    [[nodiscard]] std::optional<value_type> pop() { return try_pop(); }
+
+    bool wait_and_push(const value_type& value) { return wait_and_push_impl(value); }
+
+    bool wait_and_push(value_type&& value) { return wait_and_push_impl(std::move(value)); }
+
+    // discard: drop the oldest element if the queue is full
+    bool push(const value_type& value, const bool discard = false) { return push_impl(value, discard); }
+
+    bool push(value_type&& value, const bool discard = false)
+    {
+        return push_impl(std::move(value), discard);
+    }
+
+    void drain()
+    {
+        while (try_pop()) {}
+
+        wake_all();
+    }
+
+    void start()
+    {
+        stopped_.store(false, std::memory_order_release);
+
+        wake_all();
+    }
+
+    void stop()
+    {
+        stopped_.store(true, std::memory_order_release);
+
+        drain();
+    }
+
+    void notify_all() { wake_all(); }
+
+private:
+    struct slot_t
+    {
+        std::atomic<size_t>       seq{};
+        std::optional<value_type> value{};
+    };
+
+    // false if the slot at the write index is still owned by the reader (full or being read)
+    [[nodiscard]] bool writable() const noexcept
+    {
+        const auto pos = tail_.load(std::memory_order_relaxed);
+        return slots_[pos % capacity_].seq.load(std::memory_order_acquire) == pos;
+    }
+
+    template<class U> bool try_push(U&& value)
+    {
+        const auto pos  = tail_.load(std::memory_order_relaxed);
+        auto&      slot = slots_[pos % capacity_];
+
+        if (slot.seq.load(std::memory_order_acquire) != pos) return false;
+
+        slot.value.emplace(std::forward<U>(value));
+        slot.seq.store(pos + 1, std::memory_order_release);
+        tail_.store(pos + 1, std::memory_order_seq_cst);
+
+        wake_one(readable_, pop_waiters_);
+        return true;
+    }
+
+    std::optional<value_type> try_pop()
+    {
+        auto pos = head_.load(std::memory_order_relaxed);
+        while (true) {
+            auto&      slot = slots_[pos % capacity_];
+            const auto seq  = slot.seq.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+
+            if (diff < 0) return std::nullopt; // empty
+
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    std::optional<value_type> value{ std::move(slot.value) };
+                    slot.value.reset();
+                    slot.seq.store(pos + capacity_, std::memory_order_seq_cst);
+
+                    wake_one(writable_, push_waiters_);
+                    return value;
+                }
+            }
+            else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    template<class U> bool wait_and_push_impl(U&& value)
+    {
+        while (!stopped()) {
+            if (try_push(std::forward<U>(value))) return true;
+
+            park(writable_, push_waiters_, [this] { return stopped() || writable(); });
+        }
+
+        return false;
+    }
+
+    template<class U> bool push_impl(U&& value, const bool discard)
+    {
+        while (!stopped()) {
+            if (try_push(std::forward<U>(value))) return true;
+
+            if (!discard) return false;
+
+            // full: drop the oldest one; otherwise the reader is just moving the element out
+            if (size() >= capacity_) {
+                (void)try_pop();
+            }
+            else {
+                std::this_thread::yield();
+            }
+        }
+
+        return false;
+    }
+
+    template<class Pred>
+    static void park(std::atomic<uint32_t>& epoch, std::atomic<uint32_t>& waiters, Pred ready)
+    {
+        waiters.fetch_add(1, std::memory_order_seq_cst);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        const auto current = epoch.load(std::memory_order_acquire);
+        if (!ready()) epoch.wait(current, std::memory_order_acquire);
+
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    static void wake_one(std::atomic<uint32_t>& epoch, const std::atomic<uint32_t>& waiters)
+    {
+        if (waiters.load(std::memory_order_seq_cst) == 0) return;
+
+        epoch.fetch_add(1, std::memory_order_release);
+        epoch.notify_one();
+    }
+
+    void wake_all()
+    {
+        readable_.fetch_add(1, std::memory_order_release);
+        readable_.notify_all();
+
+        writable_.fetch_add(1, std::memory_order_release);
+        writable_.notify_all();
+    }
+
+    const size_t              capacity_;
+    std::unique_ptr<slot_t[]> slots_;
+
+    alignas(64) std::atomic<size_t> head_{ 0 };
+    alignas(64) std::atomic<size_t> tail_{ 0 };
+
+    // wake-up epochs & the number of threads parked on them
+    alignas(64) std::atomic<uint32_t> readable_{ 0 };
+    std::atomic<uint32_t>             pop_waiters_{ 0 };
+    alignas(64) std::atomic<uint32_t> writable_{ 0 };
+    std::atomic<uint32_t>             push_waiters_{ 0 };
+
+    std::atomic<bool> stopped_{ false };
+};
+
+#endif //! CAPTURER_SPSC_QUEUE_H
@@ -75,6 +75,10 @@ private:
 
     uint32_t frame_number_{};
 
+    // the frames arrive at the refresh rate, throttled to the requested frame rate
+    std::chrono::nanoseconds interval_{};
+    std::chrono::nanoseconds next_{};
+
     // options @{
     D3D11_BOX box_{ .front = 0, .back = 1 };
     // @}
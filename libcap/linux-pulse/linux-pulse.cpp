@@ -177,6 +177,52 @@ namespace pulse
         }
     }
 
+    struct latency_profile_t
+    {
+        pa_usec_t fragsize; // record
+        pa_usec_t tlength;  // playback, 0: 1024 frames at the sample rate of the stream
+        pa_usec_t minreq;   // playback, 0: by the server
+    };
+
+    static latency_profile_t latency_profile(const std::string& name)
+    {
+        if (name == "ultra-low") return { 10'000, 10'000, 2'500 };
+        if (name == "power-saving") return { 200'000, 200'000, 100'000 };
+
+        if (name != "normal") logw("[PULSE-AUDIO] unknown latency profile '{}', use 'normal'", name);
+
+        return { 25'000, 0, 0 };
+    }
+
+    pa_buffer_attr record_buffer_attr(const std::string& latency, const pa_sample_spec *spec)
+    {
+        const auto profile = latency_profile(latency);
+
+        return {
+            .maxlength = static_cast<uint32_t>(-1),
+            .tlength   = static_cast<uint32_t>(-1),
+            .prebuf    = static_cast<uint32_t>(-1),
+            .minreq    = static_cast<uint32_t>(-1),
+            .fragsize  = static_cast<uint32_t>(::pa_usec_to_bytes(profile.fragsize, spec)),
+        };
+    }
+
+    pa_buffer_attr playback_buffer_attr(const std::string& latency, const pa_sample_spec *spec)
+    {
+        const auto profile = latency_profile(latency);
+        const auto tlength = static_cast<uint32_t>(
+            profile.tlength ? ::pa_usec_to_bytes(profile.tlength, spec) : 1024 * ::pa_frame_size(spec));
+
+        return {
+            .maxlength = tlength * 2,
+            .tlength   = tlength,
+            .prebuf    = 0,
+            .minreq    = profile.minreq ? static_cast<uint32_t>(::pa_usec_to_bytes(profile.minreq, spec))
+                                        : static_cast<uint32_t>(-1),
+            .fragsize  = 0,
+        };
+    }
+
     std::vector<av::device_t> source_list()
     {
         if (!pulse::context_is_ready()) return {};
@@ -5,9 +5,23 @@
 #include "libcap/linux-pulse/linux-pulse.h"
 #include "logging.h"
 
+#include <cstring>
+
+#include <algorithm>
+#include <cmath>
 #include <fmt/format.h>
 #include <probe/defer.h>
 
+// the gains of the clock loop: the phase error is absorbed in ~32 chunks, critically damped
+static constexpr double PLL_KP = 1.0 / 32;
+static constexpr double PLL_KI = PLL_KP * PLL_KP / 4;
+
+// the sound card clocks are within some hundred ppm of the nominal rate
+static constexpr double PLL_MAX_DRIFT = 0.002;
+
+// re-anchored on larger errors: overruns, suspended sources
+static constexpr double PLL_RESYNC_THRESHOLD = 50'000'000; // ns
+
 PulseCapturer::PulseCapturer() { pulse::init(); }
 
 bool PulseCapturer::has(const AVMediaType type) const
@@ -18,8 +32,11 @@ bool PulseCapturer::has(const AVMediaType type) const
     }
 }
 
-int PulseCapturer::open(const std::string& name, std::map<std::string, std::string>)
+int PulseCapturer::open(const std::string& name, std::map<std::string, std::string> options)
 {
+    // the worker of the previous stream would never be woken up again, stop() first
+    if (thread_.joinable()) return av::ALREADY;
+
     const auto spec = pulse::source_format(name);
     afmt            = {
                    .sample_rate = static_cast<int>(spec.rate),
@@ -45,33 +62,72 @@ int PulseCapturer::open(const std::string& name, std::map<std::string, std::stri
         pulse::loop_lock();
         defer(pulse::loop_unlock());
 
+        ::pa_stream_set_state_callback(stream_, pulse_stream_state_callback, this);
         ::pa_stream_set_read_callback(stream_, pulse_stream_read_callback, this);
 
         bytes_per_frame_ = ::pa_frame_size(&spec);
 
-        const pa_buffer_attr buffer_attr{
-            .maxlength = static_cast<uint32_t>(-1),
-            .tlength   = static_cast<uint32_t>(-1),
-            .prebuf    = static_cast<uint32_t>(-1),
-            .minreq    = static_cast<uint32_t>(-1),
-            .fragsize  = static_cast<uint32_t>(::pa_usec_to_bytes(25000, &spec)),
-        };
-        if (::pa_stream_connect_record(stream_, name.c_str(), &buffer_attr, PA_STREAM_ADJUST_LATENCY) !=
-            0) {
+        samples_        = 0;
+        nominal_period_ = static_cast<double>(OS_TIME_BASE) / spec.rate;
+        period_         = nominal_period_;
+        resynced_       = 0;
+
+        // ultra-low, normal, power-saving
+        latency_ = options.contains("latency") ? options.at("latency") : "normal";
+
+        const auto buffer_attr = pulse::record_buffer_attr(latency_, &spec);
+
+        // 1s in the ring
+        ring_size_  = ::pa_usec_to_bytes(1'000'000, &spec);
+        ring_       = std::make_unique<uint8_t[]>(ring_size_);
+        ring_write_ = 0;
+        ring_read_  = 0;
+        dropped_    = 0;
+
+        // the chunks are queued until the worker is started
+        chunks_.start();
+
+        // the timing info is interpolated and updated by the server, see timestamp()
+        const auto flags = static_cast<pa_stream_flags_t>(
+            PA_STREAM_ADJUST_LATENCY | PA_STREAM_INTERPOLATE_TIMING | PA_STREAM_AUTO_TIMING_UPDATE);
+        if (::pa_stream_connect_record(stream_, name.c_str(), &buffer_attr, flags) != 0) {
             loge("[PULSE-AUDIO] failed to connect record.");
             return -1;
         }
+
+        while (::pa_stream_get_state(stream_) != PA_STREAM_READY) {
+            if (!PA_STREAM_IS_GOOD(::pa_stream_get_state(stream_))) {
+                loge("[PULSE-AUDIO] record stream error");
+                return -1;
+            }
+            pulse::wait();
+        }
+
+        // the frames of up to 4 fragments from the pool, by the negotiated fragment size, which may be
+        // larger than the requested one with PA_STREAM_ADJUST_LATENCY
+        fragsize_  = ::pa_stream_get_buffer_attr(stream_)->fragsize;
+        pool_size_ = static_cast<size_t>(fragsize_) * 4;
+        av_buffer_pool_uninit(&pool_);
+        if (pool_ = av_buffer_pool_init(pool_size_, av_buffer_alloc); !pool_) {
+            loge("[PULSE-AUDIO] failed to create the frame pool.");
+            return av::NOMEM;
+        }
+
+        thread_ = std::jthread([this] { run(); });
     }
 
     eof_     = 0x00;
     running_ = true;
     ready_   = true;
 
-    logi("[PULSE-AUDIO] {} opened", name);
+    logi("[PULSE-AUDIO] {} opened, latency = {}, fragsize = {}us", name, latency_,
+         ::pa_bytes_to_usec(fragsize_, &spec));
 
     return 0;
 }
 
+void PulseCapturer::pulse_stream_state_callback(pa_stream *, void *) { pulse::signal(0); }
+
 void PulseCapturer::pulse_stream_read_callback(pa_stream *stream, size_t /* == bytes*/, void *userdata)
 {
     const auto self = static_cast<PulseCapturer *>(userdata);
@@ -92,33 +148,126 @@ void PulseCapturer::pulse_stream_read_callback(pa_stream *stream, size_t /* == b
         return;
     }
 
-    const av::frame frame{};
-
-    frame->nb_samples = static_cast<int>(bytes / self->bytes_per_frame_);
-    // FIXME: calculate the exact pts
-    frame->pts =
-        av::clock::ns().count() - av_rescale(frame->nb_samples, self->afmt.sample_rate, OS_TIME_BASE);
-    frame->pkt_dts     = frame->pts;
-    frame->format      = self->afmt.sample_fmt;
-    frame->sample_rate = self->afmt.sample_rate;
-    frame->ch_layout   = self->afmt.ch_layout;
-
-    av_frame_get_buffer(frame.get(), 0);
-    if (av_samples_copy(frame->data, (uint8_t *const *)&frames, 0, 0, frame->nb_samples,
-                        self->afmt.ch_layout.nb_channels, self->afmt.sample_fmt) < 0) {
-        loge("[PULSE-AUDIO] failed to copy frames");
+    const auto nb_samples = static_cast<int64_t>(bytes / self->bytes_per_frame_);
+
+    self->push(frames, bytes, self->timestamp(nb_samples));
+
+    pa_stream_drop(stream);
+}
+
+// The pts of a chunk is the capture time of its first sample, predicted by the samples counted since the
+// stream started, instead of the time the callback happens to run. The prediction is corrected by the
+// capture time measured by the latency of the stream, the error of which is smoothed by a 2nd order loop:
+// the phase follows the measurement slowly and the period tracks the drift of the sound card clock.
+int64_t PulseCapturer::timestamp(const int64_t nb_samples)
+{
+    // now - the samples waiting in the source and in the record buffer, including this chunk
+    auto measured = static_cast<double>(av::clock::ns().count());
+
+    pa_usec_t latency  = 0;
+    int       negative = 0;
+    if (::pa_stream_get_latency(stream_, &latency, &negative) == 0)
+        measured -= static_cast<double>(latency) * 1'000 * (negative ? -1 : 1);
+    else
+        measured -= static_cast<double>(nb_samples) * nominal_period_; // no timing info yet
+
+    if (const auto error = measured - next_pts_; samples_ == 0 || std::abs(error) > PLL_RESYNC_THRESHOLD) {
+        if (samples_) resynced_ = error; // logged by the worker
+
+        next_pts_ = measured;
+        period_   = nominal_period_;
+    }
+    else {
+        const auto min = nominal_period_ * (1 - PLL_MAX_DRIFT);
+        const auto max = nominal_period_ * (1 + PLL_MAX_DRIFT);
+
+        next_pts_ += PLL_KP * error;
+        period_    = std::clamp(period_ + PLL_KI * error / static_cast<double>(nb_samples), min, max);
+    }
+
+    const auto pts  = std::llround(next_pts_);
+    next_pts_      += static_cast<double>(nb_samples) * period_;
+    samples_       += nb_samples;
+
+    return pts;
+}
+
+void PulseCapturer::push(const void *data, const size_t bytes, const int64_t pts)
+{
+    const auto used = ring_write_ - ring_read_.load(std::memory_order_acquire);
+    if (bytes > ring_size_ - used) {
+        dropped_ += bytes;
+        return;
+    }
+
+    const auto offset = ring_write_ % ring_size_;
+    const auto first  = std::min(bytes, ring_size_ - offset);
+    std::memcpy(ring_.get() + offset, data, first);
+    std::memcpy(ring_.get(), static_cast<const uint8_t *>(data) + first, bytes - first);
+
+    const chunk_t chunk{
+        .pts      = pts,
+        .offset   = offset,
+        .bytes    = bytes,
+        .dropped  = dropped_,
+        .resynced = resynced_,
+        .drift    = (period_ / nominal_period_ - 1) * 1'000'000,
+    };
+    if (!chunks_.push(chunk)) {
+        dropped_ += bytes;
         return;
     }
 
-    if (self->muted_)
-        av_samples_set_silence(frame->data, 0, frame->nb_samples, frame->ch_layout.nb_channels,
-                               self->afmt.sample_fmt);
+    ring_write_ += bytes;
+    dropped_     = 0;
+    resynced_    = 0;
+}
 
-    logd("[A] pts = {:>14d}, samples = {:>6d}", frame->pts, frame->nb_samples);
+void PulseCapturer::run()
+{
+    probe::thread::set_name("PULSE-CAPTURER");
 
-    self->onarrived(frame, AVMEDIA_TYPE_AUDIO);
+    const auto channels = afmt.ch_layout.nb_channels;
 
-    pa_stream_drop(stream);
+    while (const auto chunk = chunks_.wait_and_pop()) {
+        if (chunk->dropped) logw("[PULSE-AUDIO] overrun, {} bytes dropped", chunk->dropped);
+        if (chunk->resynced)
+            logw("[PULSE-AUDIO] clock re-anchored, error = {:.3f}ms", chunk->resynced / 1'000'000);
+
+        const av::frame frame{};
+
+        frame->nb_samples  = static_cast<int>(chunk->bytes / bytes_per_frame_);
+        frame->pts         = chunk->pts;
+        frame->pkt_dts     = frame->pts;
+        frame->format      = afmt.sample_fmt;
+        frame->sample_rate = afmt.sample_rate;
+        frame->ch_layout   = afmt.ch_layout;
+
+        // the pulse audio formats are packed, one plane
+        if (chunk->bytes <= pool_size_ && (frame->buf[0] = av_buffer_pool_get(pool_))) {
+            av_samples_fill_arrays(frame->data, frame->linesize, frame->buf[0]->data, channels,
+                                   frame->nb_samples, afmt.sample_fmt, 1);
+        }
+        else if (av_frame_get_buffer(frame.get(), 0) < 0) {
+            loge("[PULSE-AUDIO] failed to allocate the frame");
+            ring_read_.fetch_add(chunk->bytes, std::memory_order_release);
+            continue;
+        }
+
+        const auto first = std::min(chunk->bytes, ring_size_ - chunk->offset);
+        std::memcpy(frame->data[0], ring_.get() + chunk->offset, first);
+        std::memcpy(frame->data[0] + first, ring_.get(), chunk->bytes - first);
+
+        ring_read_.fetch_add(chunk->bytes, std::memory_order_release);
+
+        if (muted_)
+            av_samples_set_silence(frame->data, 0, frame->nb_samples, channels, afmt.sample_fmt);
+
+        logd("[A] pts = {:>14d}, samples = {:>6d}, drift = {:+.1f}ppm", frame->pts, frame->nb_samples,
+             chunk->drift);
+
+        onarrived(frame, AVMEDIA_TYPE_AUDIO);
+    }
 }
 
 int PulseCapturer::start() { return 0; }
@@ -130,11 +279,18 @@ void PulseCapturer::stop()
 
     if (stream_) {
         pulse::loop_lock();
+        ::pa_stream_set_state_callback(stream_, nullptr, nullptr);
         pa_stream_disconnect(stream_);
         pa_stream_unref(stream_);
         stream_ = nullptr;
         pulse::loop_unlock();
     }
+
+    // no more callbacks, the pending chunks are discarded
+    chunks_.stop();
+    if (thread_.joinable()) thread_.join();
+
+    av_buffer_pool_uninit(&pool_);
 }
 
 PulseCapturer::~PulseCapturer()
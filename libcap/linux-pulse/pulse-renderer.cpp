@@ -44,13 +44,7 @@ int PulseAudioRenderer::open(const std::string&, RenderFlags)
     ::pa_stream_set_state_callback(stream_, pulse_stream_state_callback, this);
     ::pa_stream_set_latency_update_callback(stream_, pulse_stream_latency_callback, this);
 
-    buffer_attrs_ = {
-        .maxlength = 1024 * bytes_per_frame_ * 2,
-        .tlength   = 1024 * bytes_per_frame_,
-        .prebuf    = 0,
-        .minreq    = static_cast<uint32_t>(-1),
-        .fragsize  = 0,
-    };
+    buffer_attrs_ = pulse::playback_buffer_attr(latency, &spec);
     if (::pa_stream_connect_playback(stream_, nullptr, &buffer_attrs_,
                                      PA_STREAM_START_CORKED | PA_STREAM_INTERPOLATE_TIMING |
                                          PA_STREAM_AUTO_TIMING_UPDATE | PA_STREAM_ADJUST_LATENCY,
@@ -62,11 +56,13 @@ int PulseAudioRenderer::open(const std::string&, RenderFlags)
     while (!stream_ready_)
         pulse::wait();
 
+    // the negotiated one
     buffer_attrs_ = *pa_stream_get_buffer_attr(stream_);
 
     ready_ = true;
 
-    logi("[PULSE-AUDIO] opened");
+    logi("[PULSE-AUDIO] opened, latency = {}, tlength = {}us, minreq = {}us", latency,
+         ::pa_bytes_to_usec(buffer_attrs_.tlength, &spec), ::pa_bytes_to_usec(buffer_attrs_.minreq, &spec));
 
     return 0;
 }
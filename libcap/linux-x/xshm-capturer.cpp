@@ -2,22 +2,30 @@
 
 #ifdef __linux__
 
+#include "libcap/blend.h"
 #include "libcap/linux-x/linux-x.h"
 #include "logging.h"
 
 #include <fmt/chrono.h>
 #include <probe/defer.h>
+#include <ctime>
 #include <sys/shm.h>
+#include <xcb/damage.h>
 #include <xcb/shm.h>
 #include <xcb/xcb.h>
 #include <xcb/xfixes.h>
 
 extern "C" {
+#include <libavutil/avstring.h>
 #include <libavutil/buffer.h>
 #include <libavutil/common.h>
+#include <libavutil/detection_bbox.h>
 #include <libavutil/imgutils.h>
 }
 
+// more rectangles than this are merged into their bounding box
+static constexpr size_t MAX_DAMAGE_RECTS = 64;
+
 #if LIBAVUTIL_VERSION_MAJOR < 57
 static AVBufferRef *xshm_alloc(void *opaque, const int size)
 #else
@@ -47,65 +55,225 @@ static AVBufferRef *xshm_alloc(void *opaque, const size_t size)
     return ffbuf;
 }
 
-int XshmCapturer::xfixes_draw_cursor(av::frame& frame) const
+void XshmCapturer::update_cursor()
 {
-    const auto ci = xcb_xfixes_get_cursor_image_reply(conn_, ::xcb_xfixes_get_cursor_image(conn_), nullptr);
-    if (!ci) {
-        loge("[ XCB-XFIXES] failed to get cursor image");
-        return -1;
+    // the image is fetched only after CursorNotify, its reply carries the position as well
+    if (cursor_dirty_) {
+        const auto ci =
+            xcb_xfixes_get_cursor_image_reply(conn_, ::xcb_xfixes_get_cursor_image(conn_), nullptr);
+        if (!ci) {
+            loge("[ XCB-XFIXES] failed to get cursor image");
+            return;
+        }
+        defer(::free(ci));
+
+        const auto pixels = xcb_xfixes_get_cursor_image_cursor_image(ci);
+        const auto length = xcb_xfixes_get_cursor_image_cursor_image_length(ci);
+
+        cursor_.image.assign(pixels, pixels + length);
+        cursor_.width  = ci->width;
+        cursor_.height = ci->height;
+        cursor_.xhot   = ci->xhot;
+        cursor_.yhot   = ci->yhot;
+
+        if (ci->x != cursor_x_ || ci->y != cursor_y_) cursor_changed_ = true;
+
+        cursor_x_     = ci->x;
+        cursor_y_     = ci->y;
+        cursor_dirty_ = false;
+        return;
     }
-    defer(free(ci));
 
-    const auto cursor = xcb_xfixes_get_cursor_image_cursor_image(ci);
-    if (!cursor) return -1;
+    // the position of the cursor is not reported by any event
+    const auto pointer = xcb_query_pointer_reply(conn_, ::xcb_query_pointer(conn_, wid_), nullptr);
+    if (!pointer) return;
+    defer(::free(pointer));
+
+    if (pointer->root_x != cursor_x_ || pointer->root_y != cursor_y_) cursor_changed_ = true;
 
-    // (x, y) world cusor position, (xhot, yhot) offset in cursor image
-    const auto cx = ci->x - ci->xhot;
-    const auto cy = ci->y - ci->yhot;
+    cursor_x_ = pointer->root_x;
+    cursor_y_ = pointer->root_y;
+}
+
+void XshmCapturer::xfixes_draw_cursor(av::frame& frame, const int16_t px, const int16_t py)
+{
+    cursor_rect_ = {};
+
+    if (cursor_.image.size() < static_cast<size_t>(cursor_.width) * cursor_.height) return;
+
+    // (px, py) world cusor position, (xhot, yhot) offset in cursor image
+    const int cx = px - cursor_.xhot;
+    const int cy = py - cursor_.yhot;
 
     // intersection
     const auto x = std::max(cx, left);
     const auto y = std::max(cy, top);
 
-    const auto w = std::min(cx + ci->width, left + vfmt.width) - x;
-    const auto h = std::min(cy + ci->height, top + vfmt.height) - y;
-
-    //
-    const int pbytes = bpp_ / 8;
-    auto      fptr   = frame->data[0] + (x - left) * pbytes + (y - top) * frame->linesize[0];
-    auto      cptr   = cursor + (x - cx) + (y - cy) * ci->width;
-
-    for (int i = 0; i < h; ++i, fptr += frame->linesize[0], cptr += ci->width) {
-        auto fline = fptr;
-        auto cline = cptr;
-        for (int j = 0; j < w; ++j, fline += pbytes, ++cline) {
-
-            const uint8_t r = (*cline >> 0) & 0xff;
-            const uint8_t g = (*cline >> 8) & 0xff;
-            const uint8_t b = (*cline >> 16) & 0xff;
-            const uint8_t a = (*cline >> 24) & 0xff;
-
-            switch (a) {
-            case 0: break;
-            case 255:
-                fline[0] = r;
-                fline[1] = g;
-                fline[2] = b;
-                break;
-            default:
-                fline[0] = r + (fline[0] * (255 - a) + 127) / 255;
-                fline[1] = g + (fline[1] * (255 - a) + 127) / 255;
-                fline[2] = b + (fline[2] * (255 - a) + 127) / 255;
-                break;
-            }
+    const auto w = std::min(cx + cursor_.width, left + vfmt.width) - x;
+    const auto h = std::min(cy + cursor_.height, top + vfmt.height) - y;
+
+    if (w <= 0 || h <= 0) return;
+
+    cursor_rect_ = {
+        static_cast<int16_t>(x - left),
+        static_cast<int16_t>(y - top),
+        static_cast<uint16_t>(w),
+        static_cast<uint16_t>(h),
+    };
+
+    const int  pbytes = bpp_ / 8;
+    const auto fptr   = frame->data[0] + (x - left) * pbytes + (y - top) * frame->linesize[0];
+    const auto cptr   = cursor_.image.data() + (x - cx) + (y - cy) * cursor_.width;
+
+    blend::argb_over(fptr, frame->linesize[0], pbytes, cptr, cursor_.width, w, h);
+}
+
+// the damaged rectangles are reported as detection boxes labeled "damage", which the encoders ignore
+static void set_damage_side_data(av::frame& frame, std::vector<xcb_rectangle_t>& rects)
+{
+    if (rects.empty()) return;
+
+    if (rects.size() > MAX_DAMAGE_RECTS) {
+        int x0 = rects[0].x, y0 = rects[0].y, x1 = x0, y1 = y0;
+        for (const auto& rect : rects) {
+            x0 = std::min<int>(x0, rect.x);
+            y0 = std::min<int>(y0, rect.y);
+            x1 = std::max<int>(x1, rect.x + rect.width);
+            y1 = std::max<int>(y1, rect.y + rect.height);
         }
+        rects = { {
+            static_cast<int16_t>(x0),
+            static_cast<int16_t>(y0),
+            static_cast<uint16_t>(x1 - x0),
+            static_cast<uint16_t>(y1 - y0),
+        } };
     }
 
+    const auto nb_rects = static_cast<uint32_t>(rects.size());
+    const auto header   = av_detection_bbox_create_side_data(frame.get(), nb_rects);
+    if (!header) return;
+
+    av_strlcpy(header->source, "xdamage", sizeof(header->source));
+    for (size_t i = 0; i < rects.size(); ++i) {
+        const auto bbox = av_get_detection_bbox(header, static_cast<unsigned int>(i));
+
+        bbox->x                 = rects[i].x;
+        bbox->y                 = rects[i].y;
+        bbox->w                 = rects[i].width;
+        bbox->h                 = rects[i].height;
+        bbox->detect_confidence = av_make_q(1, 1);
+        av_strlcpy(bbox->detect_label, "damage", sizeof(bbox->detect_label));
+    }
+}
+
+int XshmCapturer::xdamage_init()
+{
+    const auto ext = ::xcb_get_extension_data(conn_, &xcb_damage_id);
+    if (!ext || !ext->present) {
+        logw("[ LINUX-XSHM] XDamage is not supported");
+        return -1;
+    }
+
+    // required before any other request of the extension
+    const auto version = xcb_damage_query_version_reply(
+        conn_, ::xcb_damage_query_version(conn_, XCB_DAMAGE_MAJOR_VERSION, XCB_DAMAGE_MINOR_VERSION),
+        nullptr);
+    if (!version) {
+        logw("[ LINUX-XSHM] failed to query XDamage version");
+        return -1;
+    }
+    ::free(version);
+
+    damage_event_ = ext->first_event;
+
+    region_ = ::xcb_generate_id(conn_);
+    ::xcb_xfixes_create_region(conn_, region_, 0, nullptr);
+
+    // one DamageNotify each time the damage becomes non-empty, fetch_damage() empties it again
+    damage_ = ::xcb_generate_id(conn_);
+    ::xcb_damage_create(conn_, damage_, wid_, XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY);
+    ::xcb_flush(conn_);
+
+    logi("[ LINUX-XSHM] XDamage enabled");
     return 0;
 }
 
-int XshmCapturer::open(const std::string& name, std::map<std::string, std::string>)
+void XshmCapturer::xdamage_release()
+{
+    if (damage_) ::xcb_damage_destroy(conn_, damage_);
+    if (region_) ::xcb_xfixes_destroy_region(conn_, region_);
+
+    damage_     = {};
+    region_     = {};
+    last_frame_ = nullptr;
+}
+
+void XshmCapturer::poll_events()
+{
+    while (const auto event = ::xcb_poll_for_event(conn_)) {
+        const auto type = event->response_type & ~0x80;
+
+        if (damage_event_ && type == damage_event_ + XCB_DAMAGE_NOTIFY) {
+            damaged_ = true;
+        }
+        else if (xfixes_event_ && type == xfixes_event_ + XCB_XFIXES_CURSOR_NOTIFY) {
+            cursor_changed_ = true;
+            cursor_dirty_   = true;
+        }
+
+        ::free(event);
+    }
+}
+
+bool XshmCapturer::changed() const
+{
+    return !last_frame_ || damaged_ || (draw_cursor && cursor_changed_);
+}
+
+void XshmCapturer::fetch_damage(std::vector<xcb_rectangle_t>& rects)
 {
+    rects.clear();
+
+    if (!damaged_) return;
+    damaged_ = false;
+
+    // move the accumulated damage into region_ and clear it
+    ::xcb_damage_subtract(conn_, damage_, XCB_NONE, region_);
+
+    const auto reply =
+        xcb_xfixes_fetch_region_reply(conn_, ::xcb_xfixes_fetch_region(conn_, region_), nullptr);
+    if (!reply) return;
+    defer(::free(reply));
+
+    const auto rectangles = ::xcb_xfixes_fetch_region_rectangles(reply);
+    const auto length     = ::xcb_xfixes_fetch_region_rectangles_length(reply);
+
+    for (int i = 0; i < length; ++i) {
+        const auto& rect = rectangles[i];
+
+        const int x0 = std::max<int>(rect.x, left);
+        const int y0 = std::max<int>(rect.y, top);
+        const int x1 = std::min<int>(rect.x + rect.width, left + vfmt.width);
+        const int y1 = std::min<int>(rect.y + rect.height, top + vfmt.height);
+
+        if (x1 > x0 && y1 > y0) {
+            rects.push_back({
+                static_cast<int16_t>(x0 - left),
+                static_cast<int16_t>(y0 - top),
+                static_cast<uint16_t>(x1 - x0),
+                static_cast<uint16_t>(y1 - y0),
+            });
+        }
+    }
+}
+
+int XshmCapturer::open(const std::string& name, std::map<std::string, std::string> options)
+{
+    // the number of SHM requests in flight, 1: grab and dispatch serially
+    if (options.contains("pipeline_depth")) {
+        pipeline_depth_ = std::clamp<size_t>(std::stoul(options.at("pipeline_depth")), 1, 4);
+    }
+
     int nb_screen{ -1 };
     conn_ = ::xcb_connect(name.c_str(), &nb_screen);
 
@@ -178,12 +346,133 @@ int XshmCapturer::open(const std::string& name, std::map<std::string, std::strin
     }
     ::free(xfixes_version);
 
+    // the cursor image is cached and only refreshed on CursorNotify
+    if (draw_cursor) {
+        cursor_dirty_ = true;
+        xfixes_event_ = ::xcb_get_extension_data(conn_, &xcb_xfixes_id)->first_event;
+        ::xcb_xfixes_select_cursor_input(conn_, wid_, XCB_XFIXES_CURSOR_NOTIFY_MASK_DISPLAY_CURSOR);
+        ::xcb_flush(conn_);
+    }
+
+    // xcb_damage, falls back to grabbing every frame
+    if (track_damage && xdamage_init() < 0) {
+        track_damage = false;
+    }
+
     ready_ = true;
 
-    logi("[ LINUX-XSHM] {}", av::to_string(vfmt));
+    logi("[ LINUX-XSHM] {}, pipeline depth = {}", av::to_string(vfmt), pipeline_depth_);
+    return 0;
+}
+
+static void sleep_until(const std::chrono::nanoseconds deadline)
+{
+    const timespec ts{
+        .tv_sec  = static_cast<time_t>(deadline.count() / OS_TIME_BASE),
+        .tv_nsec = static_cast<long>(deadline.count() % OS_TIME_BASE),
+    };
+
+    // av::clock is the steady clock, i.e. CLOCK_MONOTONIC
+    while (::clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+}
+
+void XshmCapturer::update_latency(const std::chrono::nanoseconds deadline)
+{
+    const auto latency = av::clock::ns() - deadline;
+
+    frames_      += 1;
+    latency_     += latency;
+    max_latency_  = std::max(max_latency_, latency);
+}
+
+int XshmCapturer::request(const std::chrono::nanoseconds pts, std::vector<xcb_rectangle_t>& rects)
+{
+    auto buf = av_buffer_pool_get(xshm_pool_);
+    if (!buf) return av::NOMEM;
+
+    const auto xseg = static_cast<xcb_shm_seg_t>(
+        reinterpret_cast<uintptr_t>(av_buffer_pool_buffer_get_opaque(buf)));
+    const auto cookie = ::xcb_shm_get_image_unchecked(conn_, wid_, left, top, vfmt.width, vfmt.height, ~0,
+                                                       XCB_IMAGE_FORMAT_Z_PIXMAP, xseg, 0);
+    ::xcb_flush(conn_);
+
+    requests_.push_back({ buf, cookie, pts, std::move(rects), cursor_changed_, cursor_x_, cursor_y_ });
+
+    rects.clear();
+    cursor_changed_ = false;
+
+    return 0;
+}
+
+int XshmCapturer::complete()
+{
+    auto req = std::move(requests_.front());
+    requests_.pop_front();
+
+    const auto img = xcb_shm_get_image_reply(conn_, req.cookie, nullptr);
+    defer(free(img));
+
+    if (!img) {
+        loge("[ LINUX-XSHM] cannot get the image data");
+        av_buffer_unref(&req.buf);
+        return -1;
+    }
+
+    av::frame frame{};
+    frame->width           = vfmt.width;
+    frame->height          = vfmt.height;
+    frame->format          = vfmt.pix_fmt;
+    frame->pts             = req.pts.count(); // the tick, the grab starts right after it
+    frame->linesize[0]     = av_image_get_linesize(vfmt.pix_fmt, vfmt.width, 0);
+    frame->buf[0]          = req.buf;
+    frame->data[0]         = req.buf->data;
+    frame->color_range     = vfmt.color.range;
+    frame->color_primaries = vfmt.color.primaries;
+    frame->color_trc       = vfmt.color.transfer;
+    frame->colorspace      = vfmt.color.space;
+
+    if (draw_cursor && bpp_ >= 24) {
+        const auto last_cursor = cursor_rect_;
+        // where the cursor was when the image was requested
+        xfixes_draw_cursor(frame, req.cursor_x, req.cursor_y);
+
+        // the cursor is erased from the old position and drawn at the new one
+        if (track_damage && req.cursor_changed) {
+            if (last_cursor.width && last_cursor.height) req.rects.push_back(last_cursor);
+            if (cursor_rect_.width && cursor_rect_.height) req.rects.push_back(cursor_rect_);
+        }
+    }
+
+    if (track_damage) {
+        // the first frame is damaged as a whole
+        if (!last_frame_) {
+            req.rects = {
+                { 0, 0, static_cast<uint16_t>(vfmt.width), static_cast<uint16_t>(vfmt.height) },
+            };
+        }
+
+        set_damage_side_data(frame, req.rects);
+
+        last_frame_ = frame;
+    }
+
+    logd("[V] size = {:>4d}x{:>4d}, ts = {:.3%T}", frame->width, frame->height,
+         std::chrono::nanoseconds{ frame->pts });
+    update_latency(req.pts);
+    onarrived(frame, AVMEDIA_TYPE_VIDEO);
+
     return 0;
 }
 
+void XshmCapturer::discard_requests()
+{
+    for (auto& req : requests_) {
+        ::xcb_discard_reply(conn_, req.cookie.sequence);
+        av_buffer_unref(&req.buf);
+    }
+    requests_.clear();
+}
+
 int XshmCapturer::start()
 {
     if (running_ || !ready_) {
@@ -191,56 +480,78 @@ int XshmCapturer::start()
         return -1;
     }
 
+    frames_      = 0;
+    overruns_    = 0;
+    latency_     = {};
+    max_latency_ = {};
+
     running_ = true;
     thread_  = std::jthread([this] {
         probe::thread::set_name("LINUX-XSHM");
 
-        av::frame frame{};
+        std::vector<xcb_rectangle_t> rects{};
+
+        const auto framerate = vfmt.framerate.num > 0 && vfmt.framerate.den > 0 ? vfmt.framerate
+                                                                                : AVRational{ 30, 1 };
+        const auto interval  = av::clock::ns(1, av_inv_q(framerate));
+
+        // absolute deadlines, so that the time spent on grabbing does not accumulate as drift
+        auto deadline = av::clock::ns();
         while (running_) {
-            std::this_thread::sleep_for(30ms);
+            deadline += interval;
 
-            frame.unref();
+            // in slices at the long intervals of time-lapse, so that stop() does not wait for a whole one
+            while (running_ && deadline - av::clock::ns() > 100ms) sleep_until(av::clock::ns() + 100ms);
+            if (!running_) break;
 
-            auto buf = av_buffer_pool_get(xshm_pool_);
-            if (!buf) {
-                running_ = false;
-                continue;
+            sleep_until(deadline);
+
+            // overrun by whole frame intervals: skip the missed ticks instead of capturing in a burst
+            if (const auto late = av::clock::ns() - deadline; late >= interval) {
+                const auto missed  = late / interval;
+                deadline          += missed * interval;
+                overruns_         += missed;
             }
 
-            const auto xseg = static_cast<xcb_shm_seg_t>(
-                reinterpret_cast<uintptr_t>(av_buffer_pool_buffer_get_opaque(buf)));
-            const auto req = ::xcb_shm_get_image_unchecked(conn_, wid_, left, top, vfmt.width, vfmt.height,
-                                                            ~0, XCB_IMAGE_FORMAT_Z_PIXMAP, xseg, 0);
-            const auto img = xcb_shm_get_image_reply(conn_, req, nullptr);
-            defer(free(img));
-            ::xcb_flush(conn_);
+            poll_events();
+            if (draw_cursor) update_cursor();
 
-            if (!img) {
-                loge("cannot get the image data");
-                av_buffer_unref(&buf);
+            // nothing changed: a new reference to the last frame with a new timestamp
+            if (track_damage) {
+                if (changed()) fetch_damage(rects);
 
+                if ((last_frame_ || !requests_.empty()) && rects.empty() &&
+                    !(draw_cursor && cursor_changed_)) {
+                    // the frames in flight go first
+                    while (!requests_.empty()) complete();
+
+                    if (!last_frame_) continue;
+
+                    av::frame frame = last_frame_;
+                    frame->pts      = deadline.count();
+                    av_frame_remove_side_data(frame.get(), AV_FRAME_DATA_DETECTION_BBOXES);
+
+                    update_latency(deadline);
+                    onarrived(frame, AVMEDIA_TYPE_VIDEO);
+                    continue;
+                }
+            }
+
+            if (request(deadline, rects) < 0) {
                 running_ = false;
                 continue;
             }
 
-            frame->width           = vfmt.width;
-            frame->height          = vfmt.height;
-            frame->format          = vfmt.pix_fmt;
-            frame->pts             = av::clock::ns().count();
-            frame->linesize[0]     = av_image_get_linesize(vfmt.pix_fmt, vfmt.width, 0);
-            frame->buf[0]          = buf;
-            frame->data[0]         = buf->data;
-            frame->color_range     = vfmt.color.range;
-            frame->color_primaries = vfmt.color.primaries;
-            frame->color_trc       = vfmt.color.transfer;
-            frame->colorspace      = vfmt.color.space;
-
-            if (draw_cursor && bpp_ >= 24) xfixes_draw_cursor(frame);
-
-            logd("[V] size = {:>4d}x{:>4d}, ts = {:.3%T}", frame->width, frame->height,
-                  std::chrono::nanoseconds{ frame->pts });
-            onarrived(frame, AVMEDIA_TYPE_VIDEO);
+            // the X server fills the new segment while the older frames are composited and dispatched
+            while (requests_.size() >= pipeline_depth_) {
+                if (complete() < 0) {
+                    running_ = false;
+                    break;
+                }
+            }
         }
+
+        discard_requests();
     });
 
     return 0;
@@ -254,11 +565,14 @@ void XshmCapturer::stop()
     if (ready_) {
         ready_ = false;
 
+        xdamage_release();
         ::av_buffer_pool_uninit(&xshm_pool_);
         ::xcb_disconnect(conn_);
     }
 
-    logi("[ LINUX-XSHM] STOPPED");
+    const auto avg = frames_ ? latency_ / static_cast<int64_t>(frames_) : 0ns;
+    logi("[ LINUX-XSHM] STOPPED, frames: {}, overruns: {}, capture latency avg = {:%T}, max = {:%T}",
+         frames_, overruns_, avg, max_latency_);
 }
 
 XshmCapturer::~XshmCapturer()
@@ -0,0 +1,258 @@
+#include "libcap/media-reader.h"
+
+#include "libcap/clock.h"
+#include "libcap/priority.h"
+#include "logging.h"
+
+#include <fmt/chrono.h>
+#include <limits>
+#include <probe/defer.h>
+
+static std::chrono::nanoseconds to_ns(const std::string& seconds)
+{
+    return av::clock::ns(std::chrono::duration<double>(std::stod(seconds)));
+}
+
+int MediaReader::open(const std::string& filename, std::map<std::string, std::string> options)
+{
+    name_ = filename;
+
+    if (options.contains("ss")) ss_ = to_ns(options.at("ss"));
+    if (options.contains("to")) to_ = to_ns(options.at("to"));
+    if (options.contains("background"))
+        background_ = options.at("background") == "1" || options.at("background") == "true";
+
+    if (avformat_open_input(&fmt_ctx_, filename.c_str(), nullptr, nullptr) < 0) {
+        loge("[    READER] failed to open the file: {}", filename);
+        return av::NOT_FOUND;
+    }
+
+    if (avformat_find_stream_info(fmt_ctx_, nullptr) < 0) {
+        loge("[    READER] failed to find the stream information");
+        return -1;
+    }
+
+    if (open_decoder(AVMEDIA_TYPE_VIDEO) < 0 || open_decoder(AVMEDIA_TYPE_AUDIO) < 0) return -1;
+
+    if (vstream_idx_ < 0 && astream_idx_ < 0) {
+        loge("[    READER] no video or audio stream: {}", filename);
+        return av::NOT_FOUND;
+    }
+
+    if (fmt_ctx_->start_time != AV_NOPTS_VALUE) {
+        start_time_ = av::clock::ns(fmt_ctx_->start_time, { 1, AV_TIME_BASE });
+    }
+
+    // to the key frame before ss, the frames in between are decoded and dropped
+    if (ss_ != av::clock::min) {
+        const auto ts = av::clock::to(ss_, { 1, AV_TIME_BASE });
+        if (avformat_seek_file(fmt_ctx_, -1, std::numeric_limits<int64_t>::min(), ts, ts, 0) < 0) {
+            loge("[    READER] failed to seek to {:%T}", ss_);
+            return -1;
+        }
+    }
+
+    ready_ = true;
+
+    logi("[    READER] [{}] is opened, duration = {:%T}", filename, duration());
+    return 0;
+}
+
+int MediaReader::open_decoder(const AVMediaType type)
+{
+    if ((type == AVMEDIA_TYPE_VIDEO && !venabled_) || (type == AVMEDIA_TYPE_AUDIO && !aenabled_)) return 0;
+
+    const AVCodec *decoder = nullptr;
+
+    const int index = av_find_best_stream(fmt_ctx_, type, -1, -1, &decoder, 0);
+    if (index < 0) return 0;
+
+    const auto stream = fmt_ctx_->streams[index];
+    auto       codec  = avcodec_alloc_context3(decoder);
+    if (!codec) return av::NOMEM;
+
+    (type == AVMEDIA_TYPE_VIDEO ? vcodec_ctx_ : acodec_ctx_) = codec;
+
+    if (avcodec_parameters_to_context(codec, stream->codecpar) < 0) return -1;
+
+    codec->pkt_timebase = stream->time_base;
+
+    AVDictionary *options = nullptr;
+    defer(av_dict_free(&options));
+    av_dict_set(&options, "threads", "auto", 0);
+    if (avcodec_open2(codec, decoder, &options) < 0) {
+        loge("[    READER] [{}] can not open the decoder: {}", av::to_char(type), decoder->name);
+        return -1;
+    }
+
+    if (type == AVMEDIA_TYPE_VIDEO) {
+        vstream_idx_ = index;
+        vfmt         = {
+            .width               = codec->width,
+            .height              = codec->height,
+            .pix_fmt             = codec->pix_fmt,
+            .framerate           = av_guess_frame_rate(fmt_ctx_, stream, nullptr),
+            .sample_aspect_ratio = codec->sample_aspect_ratio,
+            .time_base           = stream->time_base,
+            .color               = {
+                .space     = codec->colorspace,
+                .range     = codec->color_range,
+                .primaries = codec->color_primaries,
+                .transfer  = codec->color_trc,
+            },
+        };
+
+        logi("[    READER] [V] [{:>6}] {}({})", decoder->name, av::to_string(vfmt),
+             av::to_string(vfmt.color));
+    }
+    else {
+        astream_idx_ = index;
+        afmt         = {
+            .sample_rate = codec->sample_rate,
+            .sample_fmt  = codec->sample_fmt,
+            .ch_layout   = codec->ch_layout,
+            .time_base   = stream->time_base,
+        };
+
+        logi("[    READER] [A] [{:>6}] {}", decoder->name, av::to_string(afmt));
+    }
+
+    return 0;
+}
+
+int MediaReader::start()
+{
+    if (!ready_ || running_) {
+        loge("[    READER] not ready or already running");
+        return -1;
+    }
+
+    eof_     = 0x00;
+    running_ = true;
+    thread_  = std::jthread([this] { read_fn(); });
+
+    return 0;
+}
+
+void MediaReader::read_fn()
+{
+    probe::thread::set_name("READER");
+    if (background_) av::lower_thread_priority();
+
+    logi("[    READER] STARTED");
+    defer(logi("[    READER] EXITED"));
+
+    av::packet packet{};
+    while (running_) {
+        if (const int ret = av_read_frame(fmt_ctx_, packet.put()); ret < 0) {
+            // a truncated file, e.g. the intermediate of a crashed recording, is read up to the error
+            if (ret != AVERROR_EOF) loge("[    READER] failed to read the packet: {}", av::ff_errstr(ret));
+            break;
+        }
+
+        int ret = 0;
+        if (packet->stream_index == vstream_idx_)
+            ret = decode(vcodec_ctx_, packet.get(), AVMEDIA_TYPE_VIDEO);
+        else if (packet->stream_index == astream_idx_)
+            ret = decode(acodec_ctx_, packet.get(), AVMEDIA_TYPE_AUDIO);
+
+        if (ret < 0 || ended()) break;
+    }
+
+    if (!running_) return;
+
+    // drain the decoders
+    if (vcodec_ctx_) {
+        decode(vcodec_ctx_, nullptr, AVMEDIA_TYPE_VIDEO);
+        onarrived(nullptr, AVMEDIA_TYPE_VIDEO);
+    }
+
+    if (acodec_ctx_) {
+        decode(acodec_ctx_, nullptr, AVMEDIA_TYPE_AUDIO);
+        onarrived(nullptr, AVMEDIA_TYPE_AUDIO);
+    }
+
+    eof_ = 0x01;
+
+    logi("[    READER] EOF");
+}
+
+int MediaReader::decode(AVCodecContext *codec, const AVPacket *packet, const AVMediaType type)
+{
+    auto ret = avcodec_send_packet(codec, packet);
+    while (ret >= 0) {
+        ret = avcodec_receive_frame(codec, frame_.put());
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) return 0;
+
+        if (ret < 0) {
+            loge("[    READER] [{}] DECODING ERROR: {}", av::to_char(type), av::ff_errstr(ret));
+            return ret;
+        }
+
+        frame_->pts = frame_->best_effort_timestamp;
+
+        // range
+        if (const auto ts = av::clock::ns(frame_->pts, codec->pkt_timebase); ts != av::clock::nopts) {
+            if (ts < ss_) continue;
+            if (ts >= to_) {
+                (type == AVMEDIA_TYPE_VIDEO ? vended_ : aended_) = true;
+                continue;
+            }
+        }
+
+        onarrived(frame_, type);
+    }
+
+    // skip the corrupted packets
+    return ret == AVERROR_INVALIDDATA ? 0 : ret;
+}
+
+bool MediaReader::ended() const
+{
+    return (vstream_idx_ < 0 || vended_) && (astream_idx_ < 0 || aended_);
+}
+
+void MediaReader::enable(const AVMediaType type, const bool v)
+{
+    switch (type) {
+    case AVMEDIA_TYPE_VIDEO: venabled_ = v; break;
+    case AVMEDIA_TYPE_AUDIO: aenabled_ = v; break;
+    default:                 break;
+    }
+}
+
+bool MediaReader::has(const AVMediaType type) const
+{
+    switch (type) {
+    case AVMEDIA_TYPE_VIDEO: return vstream_idx_ >= 0;
+    case AVMEDIA_TYPE_AUDIO: return astream_idx_ >= 0;
+    default:                 return false;
+    }
+}
+
+std::chrono::nanoseconds MediaReader::duration() const
+{
+    if (!fmt_ctx_ || fmt_ctx_->duration == AV_NOPTS_VALUE) return av::clock::nopts;
+
+    return av::clock::ns(fmt_ctx_->duration, { 1, AV_TIME_BASE });
+}
+
+void MediaReader::stop()
+{
+    running_ = false;
+
+    if (thread_.joinable()) thread_.join();
+}
+
+MediaReader::~MediaReader()
+{
+    ready_ = false;
+
+    stop();
+
+    avcodec_free_context(&vcodec_ctx_);
+    avcodec_free_context(&acodec_ctx_);
+    avformat_close_input(&fmt_ctx_);
+
+    logi("[    READER] ~");
+}
@@ -0,0 +1,265 @@
+#include "libcap/output-file.h"
+
+#include "libcap/clock.h"
+#include "libcap/media.h"
+#include "logging.h"
+
+#include <fmt/chrono.h>
+
+extern "C" {
+#include <libavutil/mem.h>
+}
+
+#ifdef __linux__
+
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// the logical block size is 512 on most devices, the page size covers the rest
+static constexpr size_t DIRECT_IO_ALIGNMENT = 4096;
+
+static ssize_t pwrite_all(const int fd, const uint8_t *buf, size_t size, off_t offset)
+{
+    const auto total = static_cast<ssize_t>(size);
+    while (size > 0) {
+        const auto ret = ::pwrite(fd, buf, size, offset);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        buf    += ret;
+        size   -= ret;
+        offset += ret;
+    }
+    return total;
+}
+
+int OutputFile::open(const std::string& filename, const options_t& options)
+{
+    filename_    = filename;
+    buffer_size_ = (options.buffer_size + DIRECT_IO_ALIGNMENT - 1) & ~(DIRECT_IO_ALIGNMENT - 1);
+
+    fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        loge("[    OUTPUT] can not open the file: {}, {}", filename, std::strerror(errno));
+        return av::DENIED;
+    }
+
+    if (options.preallocate > 0) {
+        // keep the size, so the file is still valid if we crash before close()
+        if (::fallocate(fd_, FALLOC_FL_KEEP_SIZE, 0, options.preallocate) < 0) {
+            logw("[    OUTPUT] fallocate is not supported: {}", std::strerror(errno));
+        }
+    }
+
+    if (options.direct) {
+        direct_fd_ = ::open(filename.c_str(), O_WRONLY | O_DIRECT | O_CLOEXEC);
+        aligned_   = static_cast<uint8_t *>(std::aligned_alloc(DIRECT_IO_ALIGNMENT, buffer_size_));
+
+        if (direct_fd_ < 0 || !aligned_) {
+            logw("[    OUTPUT] O_DIRECT is not supported, fall back to the buffered I/O");
+            if (direct_fd_ >= 0) ::close(direct_fd_);
+            std::free(aligned_);
+            direct_fd_ = -1;
+            aligned_   = nullptr;
+        }
+    }
+
+    const auto buffer = static_cast<uint8_t *>(av_malloc(buffer_size_));
+    if (!buffer) return av::NOMEM;
+
+    pb_ = avio_alloc_context(buffer, static_cast<int>(buffer_size_), 1, this, nullptr, &OutputFile::write,
+                             &OutputFile::seek);
+    if (!pb_) {
+        av_free(buffer);
+        return av::NOMEM;
+    }
+
+    logi("[    OUTPUT] {}, buffer = {} KiB, direct = {}, preallocate = {} MiB", filename,
+         buffer_size_ >> 10, direct_fd_ >= 0, options.preallocate >> 20);
+
+    return 0;
+}
+
+#if LIBAVFORMAT_VERSION_MAJOR < 61
+int OutputFile::write(void *opaque, uint8_t *buf, const int size)
+#else
+int OutputFile::write(void *opaque, const uint8_t *buf, const int size)
+#endif
+{
+    const auto self = static_cast<OutputFile *>(opaque);
+    const auto len  = static_cast<size_t>(size);
+    const auto t0   = av::clock::ns();
+
+    ssize_t ret = -1;
+    // the full buffer flushes of a sequential muxer are aligned, the rest goes through the page cache
+    if (self->direct_fd_ >= 0 && len <= self->buffer_size_ && len % DIRECT_IO_ALIGNMENT == 0 &&
+        self->pos_ % DIRECT_IO_ALIGNMENT == 0) {
+        std::memcpy(self->aligned_, buf, len);
+        ret = pwrite_all(self->direct_fd_, self->aligned_, len, self->pos_);
+
+        // the device requires a larger alignment
+        if (ret < 0 && errno == EINVAL) {
+            logw("[    OUTPUT] O_DIRECT write failed, fall back to the buffered I/O");
+            ::close(self->direct_fd_);
+            self->direct_fd_ = -1;
+        }
+    }
+
+    if (self->direct_fd_ < 0 || ret < 0) {
+        ret = pwrite_all(self->fd_, buf, len, self->pos_);
+    }
+
+    if (ret < 0) {
+        const auto err = errno;
+        loge("[    OUTPUT] failed to write {} bytes: {}", size, std::strerror(err));
+        return AVERROR(err);
+    }
+
+    self->pos_  += size;
+    self->size_  = std::max(self->size_, self->pos_);
+
+    const auto elapsed    = av::clock::ns() - t0;
+    self->writes_        += 1;
+    self->bytes_         += len;
+    self->write_time_    += elapsed;
+    self->max_write_time_ = std::max(self->max_write_time_, elapsed);
+
+    return size;
+}
+
+int64_t OutputFile::seek(void *opaque, const int64_t offset, const int whence)
+{
+    const auto self = static_cast<OutputFile *>(opaque);
+
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE: return self->size_;
+    case SEEK_SET:    self->pos_ = offset; break;
+    case SEEK_CUR:    self->pos_ += offset; break;
+    case SEEK_END:    self->pos_ = self->size_ + offset; break;
+    default:          return AVERROR(EINVAL);
+    }
+
+    return self->pos_;
+}
+
+int OutputFile::close()
+{
+    if (fd_ < 0) return 0;
+
+    if (pb_) {
+        avio_flush(pb_);
+        av_freep(&pb_->buffer);
+        avio_context_free(&pb_);
+    }
+
+    // give back the preallocated blocks beyond the end
+    if (::ftruncate(fd_, size_) < 0) {
+        logw("[    OUTPUT] failed to truncate the file: {}", std::strerror(errno));
+    }
+
+    if (direct_fd_ >= 0) ::close(direct_fd_);
+    std::free(aligned_);
+
+    const auto ret = ::close(fd_);
+
+    fd_        = -1;
+    direct_fd_ = -1;
+    aligned_   = nullptr;
+
+    const auto avg = writes_ ? write_time_ / static_cast<int64_t>(writes_) : 0ns;
+    logi("[    OUTPUT] {} closed, {} writes, {} KiB, write time avg = {:%T}, max = {:%T}", filename_,
+         writes_, bytes_ >> 10, avg, max_write_time_);
+
+    return ret < 0 ? av::BAD_ADDRESS : 0;
+}
+
+#else
+
+int OutputFile::open(const std::string& filename, const options_t& options)
+{
+    filename_    = filename;
+    buffer_size_ = options.buffer_size;
+
+    if (options.direct || options.preallocate > 0) {
+        logw("[    OUTPUT] direct I/O and preallocation are only supported on Linux, ignored");
+    }
+
+    // unbuffered, every write of pb_ goes to the file as is
+    if (avio_open(&file_, filename.c_str(), AVIO_FLAG_WRITE | AVIO_FLAG_DIRECT) < 0) {
+        loge("[    OUTPUT] can not open the file: {}", filename);
+        return av::DENIED;
+    }
+
+    const auto buffer = static_cast<uint8_t *>(av_malloc(buffer_size_));
+    if (!buffer) return av::NOMEM;
+
+    pb_ = avio_alloc_context(buffer, static_cast<int>(buffer_size_), 1, this, nullptr, &OutputFile::write,
+                             &OutputFile::seek);
+    if (!pb_) {
+        av_free(buffer);
+        return av::NOMEM;
+    }
+
+    logi("[    OUTPUT] {}, buffer = {} KiB", filename, buffer_size_ >> 10);
+
+    return 0;
+}
+
+#if LIBAVFORMAT_VERSION_MAJOR < 61
+int OutputFile::write(void *opaque, uint8_t *buf, const int size)
+#else
+int OutputFile::write(void *opaque, const uint8_t *buf, const int size)
+#endif
+{
+    const auto self = static_cast<OutputFile *>(opaque);
+    const auto t0   = av::clock::ns();
+
+    avio_write(self->file_, buf, size);
+
+    if (const auto err = self->file_->error; err < 0) {
+        loge("[    OUTPUT] failed to write {} bytes, error = {}", size, err);
+        return err;
+    }
+
+    const auto elapsed    = av::clock::ns() - t0;
+    self->writes_        += 1;
+    self->bytes_         += size;
+    self->write_time_    += elapsed;
+    self->max_write_time_ = std::max(self->max_write_time_, elapsed);
+
+    return size;
+}
+
+int64_t OutputFile::seek(void *opaque, const int64_t offset, const int whence)
+{
+    const auto self = static_cast<OutputFile *>(opaque);
+
+    if (whence & AVSEEK_SIZE) return avio_size(self->file_);
+
+    return avio_seek(self->file_, offset, whence & ~AVSEEK_FORCE);
+}
+
+int OutputFile::close()
+{
+    if (!file_) return 0;
+
+    if (pb_) {
+        avio_flush(pb_);
+        av_freep(&pb_->buffer);
+        avio_context_free(&pb_);
+    }
+
+    const auto ret = avio_closep(&file_);
+
+    const auto avg = writes_ ? write_time_ / static_cast<int64_t>(writes_) : 0ns;
+    logi("[    OUTPUT] {} closed, {} writes, {} KiB, write time avg = {:%T}, max = {:%T}", filename_,
+         writes_, bytes_ >> 10, avg, max_write_time_);
+
+    return ret < 0 ? av::BAD_ADDRESS : 0;
+}
+
+#endif
@@ -0,0 +1,25 @@
+#include "libcap/priority.h"
+
+#include "logging.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif __linux__
+#include <sys/resource.h>
+#endif
+
+namespace av
+{
+    void lower_thread_priority()
+    {
+#ifdef _WIN32
+        // also lowers the I/O and memory priorities, ended by the exit of the thread
+        if (!::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN))
+            logw("[  PRIORITY] failed to lower the priority of the thread");
+#elif __linux__
+        // the nice value is per-thread on Linux
+        if (::setpriority(PRIO_PROCESS, 0, 10) < 0)
+            logw("[  PRIORITY] failed to lower the priority of the thread");
+#endif
+    }
+} // namespace av
@@ -0,0 +1,55 @@
+#include "libcap/quality-governor.h"
+
+#include "libcap/clock.h"
+
+#include <algorithm>
+
+static constexpr double HIGH_LOAD     = 0.9;
+static constexpr double HEADROOM_LOAD = 0.7;
+
+static constexpr auto STEP_DOWN_INTERVAL = 1s;
+static constexpr auto STEP_UP_INTERVAL   = 5s;
+
+QualityGovernor::QualityGovernor(const std::chrono::nanoseconds interval)
+    : interval_(std::max<std::chrono::nanoseconds>(interval, 1ms)),
+      changed_at_(av::clock::ns())
+{}
+
+bool QualityGovernor::update(const std::chrono::nanoseconds elapsed, const size_t depth,
+                             const size_t capacity)
+{
+    const auto now = av::clock::ns();
+
+    // smoothed over ~8 frames
+    const auto sample = static_cast<double>(elapsed.count()) / static_cast<double>(interval_.count());
+    load_            += (sample - load_) / 8.0;
+
+    // behind: step down
+    if (depth * 2 >= capacity || load_ > HIGH_LOAD) {
+        headroom_since_ = 0ns;
+
+        if (level_ + 1 >= levels.size() || now - changed_at_ < STEP_DOWN_INTERVAL) return false;
+
+        level_++;
+        changed_at_ = now;
+        return true;
+    }
+
+    if (level_ == 0) return false;
+
+    // headroom: step up, the encoding cost is about proportional to the encoded frames
+    const auto upper = static_cast<double>(levels[level_].decimation) / levels[level_ - 1].decimation;
+    if (depth > 1 || load_ * upper > HEADROOM_LOAD) {
+        headroom_since_ = 0ns;
+        return false;
+    }
+
+    if (headroom_since_ == 0ns) headroom_since_ = now;
+
+    if (now - headroom_since_ < STEP_UP_INTERVAL || now - changed_at_ < STEP_UP_INTERVAL) return false;
+
+    level_--;
+    changed_at_     = now;
+    headroom_since_ = 0ns;
+    return true;
+}
@@ -0,0 +1,217 @@
+#include "libcap/replay-buffer.h"
+
+#include "logging.h"
+
+#include <fmt/chrono.h>
+#include <probe/defer.h>
+
+// the memory actually pinned by the packet, including the padding of the buffer and the side data
+static size_t packet_bytes(const AVPacket *packet)
+{
+    size_t bytes = sizeof(AVPacket) + (packet->buf ? packet->buf->size : packet->size);
+    for (int i = 0; i < packet->side_data_elems; ++i) {
+        bytes += sizeof(AVPacketSideData) + packet->side_data[i].size;
+    }
+    return bytes;
+}
+
+ReplayBuffer::ReplayBuffer(const std::chrono::nanoseconds duration, const size_t size)
+    : max_duration_(duration),
+      max_size_(size)
+{}
+
+int ReplayBuffer::open(const AVFormatContext *fmt_ctx)
+{
+    if (!fmt_ctx) return av::INVALID;
+
+    for (unsigned i = 0; i < fmt_ctx->nb_streams; ++i) {
+        const auto stream   = fmt_ctx->streams[i];
+        auto       codecpar = avcodec_parameters_alloc();
+        if (!codecpar || avcodec_parameters_copy(codecpar, stream->codecpar) < 0) {
+            avcodec_parameters_free(&codecpar);
+            return av::NOMEM;
+        }
+
+        if (codecpar->codec_type == AVMEDIA_TYPE_VIDEO) vstream_idx_ = static_cast<int>(i);
+
+        streams_.push_back({ codecpar, stream->time_base });
+    }
+
+    logi("[    REPLAY] duration = {:%T}, size = {} MiB", max_duration_, max_size_ >> 20);
+
+    return 0;
+}
+
+void ReplayBuffer::push(const av::packet& packet)
+{
+    if (!packet || packet->stream_index < 0 || packet->stream_index >= static_cast<int>(streams_.size()))
+        return;
+
+    const auto ts  = av::clock::ns(packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts,
+                                   streams_[packet->stream_index].time_base);
+    const auto key = (packet->flags & AV_PKT_FLAG_KEY) &&
+                     (vstream_idx_ < 0 || packet->stream_index == vstream_idx_);
+
+    std::lock_guard lock(mtx_);
+
+    if (key) gops_.push_back({ .start = ts });
+
+    // drop the packets before the first key frame
+    if (gops_.empty()) return;
+
+    const auto bytes = packet_bytes(packet.get());
+
+    gops_.back().packets.push_back(packet);
+    gops_.back().bytes += bytes;
+    bytes_             += bytes;
+    last_ts_            = std::max(last_ts_, ts);
+
+    evict();
+}
+
+void ReplayBuffer::evict()
+{
+    // the latest GOP is never evicted, even if it alone exceeds the limits
+    while (gops_.size() > 1) {
+        const auto oversize = max_size_ > 0 && bytes_ > max_size_;
+        const auto overtime = max_duration_ > 0ns && last_ts_ - gops_[1].start >= max_duration_;
+
+        if (!oversize && !overtime) break;
+
+        bytes_ -= gops_.front().bytes;
+        gops_.pop_front();
+    }
+}
+
+size_t ReplayBuffer::size() const
+{
+    std::lock_guard lock(mtx_);
+    return bytes_;
+}
+
+std::chrono::nanoseconds ReplayBuffer::duration() const
+{
+    std::lock_guard lock(mtx_);
+    return gops_.empty() ? 0ns : last_ts_ - gops_.front().start;
+}
+
+int ReplayBuffer::save(const std::string& filename, std::function<void(int)> done)
+{
+    if (saving_.exchange(true)) {
+        logw("[    REPLAY] the previous replay is still being saved");
+        return av::AGAIN;
+    }
+
+    // snapshot: only the references are copied, the encoder keeps pushing meanwhile
+    std::vector<av::packet> packets{};
+    {
+        std::lock_guard lock(mtx_);
+
+        size_t count = 0;
+        for (const auto& gop : gops_) count += gop.packets.size();
+
+        packets.reserve(count);
+        for (const auto& gop : gops_) {
+            packets.insert(packets.end(), gop.packets.begin(), gop.packets.end());
+        }
+    }
+
+    if (packets.empty()) {
+        logw("[    REPLAY] no packets buffered");
+        saving_ = false;
+        return av::AGAIN;
+    }
+
+    // shift the timestamps so that the earliest dts starts from 0
+    auto offset = av::clock::max;
+    for (const auto& packet : packets) {
+        const auto ts = packet->dts != AV_NOPTS_VALUE ? packet->dts : packet->pts;
+        if (ts != AV_NOPTS_VALUE) {
+            offset = std::min(offset, av::clock::ns(ts, streams_[packet->stream_index].time_base));
+        }
+    }
+    if (offset == av::clock::max) offset = 0ns;
+
+    if (saver_.joinable()) saver_.join();
+
+    saver_ = std::jthread([this, filename, offset, packets = std::move(packets), done = std::move(done)] {
+        probe::thread::set_name("REPLAY-SAVER");
+
+        const auto ret = mux(filename, packets, offset);
+
+        saving_ = false;
+
+        if (done) done(ret);
+    });
+
+    return 0;
+}
+
+int ReplayBuffer::mux(const std::string& filename, const std::vector<av::packet>& packets,
+                      const std::chrono::nanoseconds offset) const
+{
+    AVFormatContext *fmt_ctx = nullptr;
+    if (avformat_alloc_output_context2(&fmt_ctx, nullptr, nullptr, filename.c_str()) < 0) {
+        loge("[    REPLAY] failed to alloc the output context: {}", filename);
+        return av::INVALID;
+    }
+    defer(avformat_free_context(fmt_ctx));
+
+    for (const auto& [codecpar, time_base] : streams_) {
+        const auto stream = avformat_new_stream(fmt_ctx, nullptr);
+        if (!stream || avcodec_parameters_copy(stream->codecpar, codecpar) < 0) return av::NOMEM;
+
+        stream->time_base           = time_base;
+        stream->codecpar->codec_tag = 0;
+    }
+
+    if (!(fmt_ctx->oformat->flags & AVFMT_NOFILE)) {
+        if (avio_open(&fmt_ctx->pb, filename.c_str(), AVIO_FLAG_WRITE) < 0) {
+            loge("[    REPLAY] can not open the output file: {}", filename);
+            return -1;
+        }
+    }
+
+    int ret = avformat_write_header(fmt_ctx, nullptr);
+    if (ret < 0) {
+        loge("[    REPLAY] can not write the header to the output file: {}", filename);
+    }
+
+    av::packet packet{};
+    for (size_t i = 0; ret >= 0 && i < packets.size(); ++i) {
+        av_packet_ref(packet.put(), packets[i].get());
+
+        const auto time_base = streams_[packet->stream_index].time_base;
+        const auto shift     = av::clock::to(offset, time_base);
+
+        if (packet->pts != AV_NOPTS_VALUE) packet->pts -= shift;
+        if (packet->dts != AV_NOPTS_VALUE) packet->dts -= shift;
+
+        // the muxer may have changed the time base of the stream while writing the header
+        av_packet_rescale_ts(packet.get(), time_base, fmt_ctx->streams[packet->stream_index]->time_base);
+
+        if ((ret = av_interleaved_write_frame(fmt_ctx, packet.get())) < 0) {
+            loge("[    REPLAY] failed to write the packet to file.");
+        }
+    }
+
+    if (ret >= 0 && (ret = av_write_trailer(fmt_ctx)) < 0) {
+        loge("[    REPLAY] failed to write trailer");
+    }
+
+    if (!(fmt_ctx->oformat->flags & AVFMT_NOFILE)) avio_closep(&fmt_ctx->pb);
+
+    if (ret >= 0) logi("[    REPLAY] {} packets are saved to {}", packets.size(), filename);
+
+    return ret;
+}
+
+ReplayBuffer::~ReplayBuffer()
+{
+    // the saver is still reading the codec parameters
+    if (saver_.joinable()) saver_.join();
+
+    for (auto& [codecpar, _] : streams_) {
+        avcodec_parameters_free(&codecpar);
+    }
+}
@@ -86,12 +86,16 @@ int WindowsGraphicsCapturer::open(const std::string&, std::map<std::string, std:
     box_.right  = left + ((std::min<int32_t>(left + vfmt.width + 1, item_.Size().Width) - left) & ~1);
     box_.bottom = top + ((std::min<int32_t>(top + vfmt.height + 1, item_.Size().Height) - top) & ~1);
 
+    const auto framerate = vfmt.framerate.num > 0 && vfmt.framerate.den > 0 ? vfmt.framerate
+                                                                            : AVRational{ 60, 1 };
+    interval_            = av::clock::ns(1, av_inv_q(framerate));
+
     // video output format
     vfmt = av::vformat_t{
         .width               = static_cast<int>(box_.right - box_.left),
         .height              = static_cast<int>(box_.bottom - box_.top),
         .pix_fmt             = AV_PIX_FMT_D3D11,
-        .framerate           = { 60, 1 },
+        .framerate           = framerate,
         .sample_aspect_ratio = { 1, 1 },
         .time_base           = { 1, OS_TIME_BASE },
         .color               = { AVCOL_SPC_RGB, AVCOL_RANGE_JPEG, AVCOL_PRI_BT709, AVCOL_TRC_IEC61966_2_1 },
@@ -117,6 +121,7 @@ int WindowsGraphicsCapturer::start()
         return -1;
     }
 
+    next_    = {};
     running_ = true;
     session_.StartCapture();
     return 0;
@@ -276,7 +281,15 @@ void WindowsGraphicsCapturer::OnFrameArrived(const winrt::Direct3D11CaptureFrame
 
     if (!running_) return;
 
-    const auto d3d11frame    = sender.TryGetNextFrame();
+    const auto d3d11frame = sender.TryGetNextFrame();
+
+    // released back to the pool right away if it comes too early, e.g. in time-lapse mode
+    const auto now = av::clock::ns();
+    if (now + interval_ / 8 < next_) return;
+
+    // on the grid of the interval, unless far behind it
+    next_ = std::max(next_ + interval_, now + interval_ / 2);
+
     const auto frame_texture = wgc::GetInterfaceFrom<::ID3D11Texture2D>(d3d11frame.Surface());
 
     // surface size
@@ -56,6 +56,7 @@ Capturer::Capturer(int& argc, char **argv)
     toggle_hotkey_      = new QHotkey(this);
     video_hotkey_       = new QHotkey(this);
     gif_hotkey_         = new QHotkey(this);
+    replay_hotkey_      = new QHotkey(this);
     quicklook_hotkey_   = new QHotkey(this);
     transparent_input_  = new QHotkey(this);
 
@@ -67,6 +68,7 @@ Capturer::Capturer(int& argc, char **argv)
     connect(toggle_hotkey_, &QHotkey::activated, this, &Capturer::TogglePreviews);
     connect(video_hotkey_, &QHotkey::activated, this, &Capturer::RecordVideo);
     connect(gif_hotkey_, &QHotkey::activated, this, &Capturer::RecordGIF);
+    connect(replay_hotkey_, &QHotkey::activated, this, &Capturer::SaveReplay);
     connect(quicklook_hotkey_, &QHotkey::activated, this, &Capturer::QuickLook);
     connect(transparent_input_, &QHotkey::activated, this, &Capturer::TransparentPreviewInput);
     connect(sniper_.get(), &ScreenShoter::pinData, this, &Capturer::PreviewMimeData);
@@ -78,6 +80,7 @@ void Capturer::RecordVideo()
         recorder_ = new ScreenRecorder(ScreenRecorder::VIDEO);
         recorder_->setAttribute(Qt::WA_DeleteOnClose);
         recorder_->setStyle(config::recording::video::style);
+        connect(recorder_, &ScreenRecorder::transcoding, this, &Capturer::TrackTranscoding);
     }
     recorder_->record();
 }
@@ -92,6 +95,28 @@ void Capturer::RecordGIF()
     gifcptr_->record();
 }
 
+void Capturer::SaveReplay()
+{
+    if (recorder_) recorder_->saveReplay();
+}
+
+void Capturer::TrackTranscoding(Transcoder *transcoder)
+{
+    connect(transcoder, &Transcoder::progress, this, [this](const int percent) {
+        tray_->setToolTip(tr("Transcoding the recording: %1%").arg(percent));
+    });
+
+    connect(transcoder, &Transcoder::finished, this, [this](const QString& path, const bool ok) {
+        tray_->setToolTip("Capturer Settings");
+
+        if (ok)
+            ShowMessage("Capturer", tr("The recording has been saved to %1").arg(path));
+        else
+            ShowMessage("Capturer", tr("Failed to transcode the recording, kept as %1").arg(path),
+                        QSystemTrayIcon::Warning);
+    });
+}
+
 void Capturer::Init()
 {
     clipboard::init();
@@ -298,6 +323,7 @@ void Capturer::UpdateHotkeys()
     SET_HOTKEY(toggle_hotkey_,      config::hotkeys::toggle_previews);
     SET_HOTKEY(video_hotkey_,       config::hotkeys::record_video);
     SET_HOTKEY(gif_hotkey_,         config::hotkeys::record_gif);
+    SET_HOTKEY(replay_hotkey_,      config::hotkeys::save_replay);
 #if _WIN32
     SET_HOTKEY(quicklook_hotkey_,   config::hotkeys::quick_look);
 #endif
@@ -48,6 +48,10 @@ public slots:
 
     void RecordVideo();
     void RecordGIF();
+    void SaveReplay();
+
+    // progress of the background transcoding in the tray
+    void TrackTranscoding(Transcoder *transcoder);
 
 private:
     void SystemTrayInit();
@@ -73,6 +77,7 @@ private:
     QPointer<QHotkey> repeat_snip_hotkey_{}; // screenshot
     QPointer<QHotkey> video_hotkey_{};       // video recording
     QPointer<QHotkey> gif_hotkey_{};         // gif recording
+    QPointer<QHotkey> replay_hotkey_{};      // save the instant replay
     QPointer<QHotkey> preview_hotkey_{};     // preview
     QPointer<QHotkey> quicklook_hotkey_{};   // Explorer window, Windows only
     QPointer<QHotkey> transparent_input_{};  // for preview window
@@ -20,6 +20,7 @@ namespace config
         JSON_GET(autorun, j, "autorun");
         JSON_GET(language, j, "language");
         JSON_GET(theme, j, "theme");
+        JSON_GET(audio_latency, j, "audio-latency");
 
         if (j.contains("hotkeys")) {
             JSON_GET(hotkeys::screenshot, j["hotkeys"], "screenshot");
@@ -29,6 +30,7 @@ namespace config
             JSON_GET(hotkeys::quick_look, j["hotkeys"], "quick-look");
             JSON_GET(hotkeys::record_video, j["hotkeys"], "record-video");
             JSON_GET(hotkeys::record_gif, j["hotkeys"], "record-gif");
+            JSON_GET(hotkeys::save_replay, j["hotkeys"], "save-replay");
             JSON_GET(hotkeys::transparent_input, j["hotkeys"], "transparent-input");
         }
 
@@ -44,6 +46,8 @@ namespace config
         }
 
         if (j.contains("recording")) {
+            JSON_GET(recording::filter_threads, j["recording"], "filter-threads");
+
             if (j["recording"].contains("video")) {
                 using namespace recording::video;
 
@@ -63,6 +67,22 @@ namespace config
 
                 JSON_GET(mic_enabled, j["recording"]["video"], "mic-enabled");
                 JSON_GET(speaker_enabled, j["recording"]["video"], "speaker-enabled");
+                JSON_GET(transcode, j["recording"]["video"], "transcode");
+                JSON_GET(transcode_jobs, j["recording"]["video"], "transcode-jobs");
+                JSON_GET(fragment_duration, j["recording"]["video"], "fragment-duration");
+                JSON_GET(segment_duration, j["recording"]["video"], "segment-duration");
+                JSON_GET(segment_size, j["recording"]["video"], "segment-size");
+                JSON_GET(timelapse, j["recording"]["video"], "timelapse");
+
+                if (j["recording"]["video"].contains("proxy")) {
+                    JSON_GET(proxy::enabled, j["recording"]["video"]["proxy"], "enabled");
+                    JSON_GET(proxy::crf, j["recording"]["video"]["proxy"], "crf");
+                }
+
+                if (j["recording"]["video"].contains("replay")) {
+                    JSON_GET(replay::duration, j["recording"]["video"]["replay"], "duration");
+                    JSON_GET(replay::size, j["recording"]["video"]["replay"], "size");
+                }
 
                 if (j["recording"]["video"].contains("v")) {
                     JSON_GET(v::codec, j["recording"]["video"]["v"], "codec");
@@ -78,11 +98,16 @@ namespace config
                     JSON_GET(v::pix_fmt, j["recording"]["video"]["v"], "pixel-format");
                     JSON_GET(v::color_space, j["recording"]["video"]["v"], "color-space");
                     JSON_GET(v::color_range, j["recording"]["video"]["v"], "color-range");
+                    JSON_GET(v::adaptive_quality, j["recording"]["video"]["v"], "adaptive-quality");
+                    JSON_GET(v::backpressure, j["recording"]["video"]["v"], "backpressure");
                 }
                 if (j["recording"]["video"].contains("a")) {
                     JSON_GET(a::codec, j["recording"]["video"]["a"], "codec");
                     JSON_GET(a::channels, j["recording"]["video"]["a"], "channels");
                     JSON_GET(a::sample_rate, j["recording"]["video"]["a"], "sample-rate");
+                    JSON_GET(a::separate_tracks, j["recording"]["video"]["a"], "separate-tracks");
+                    JSON_GET(a::backpressure, j["recording"]["video"]["a"], "backpressure");
+                    JSON_GET(a::queue_limit, j["recording"]["video"]["a"], "queue-limit");
                 }
             }
 
@@ -106,6 +131,10 @@ namespace config
                 JSON_GET(dither, j["recording"]["gif"], "dither");
             }
         }
+
+        if (j.contains("player")) {
+            JSON_GET(player::filter_threads, j["player"], "filter-threads");
+        }
     }
 
     json to_json()
@@ -114,6 +143,7 @@ namespace config
             { "autorun", autorun },
             { "language", language },
             { "theme", theme },
+            { "audio-latency", audio_latency },
             {
                 "hotkeys",
                 {
@@ -124,6 +154,7 @@ namespace config
                     { "quick-look", hotkeys::quick_look },
                     { "record-video", hotkeys::record_video },
                     { "record-gif", hotkeys::record_gif },
+                    { "save-replay", hotkeys::save_replay },
                     { "transparent-input", hotkeys::transparent_input },
                 },
 
@@ -146,6 +177,7 @@ namespace config
             {
                 "recording",
                 {
+                    { "filter-threads", recording::filter_threads },
                     {
                         "video",
                         {
@@ -165,6 +197,26 @@ namespace config
                             { "save-path", recording::video::path },
                             { "mic-enabled", recording::video::mic_enabled },
                             { "speaker-enabled", recording::video::speaker_enabled },
+                            { "transcode", recording::video::transcode },
+                            { "transcode-jobs", recording::video::transcode_jobs },
+                            { "fragment-duration", recording::video::fragment_duration },
+                            { "segment-duration", recording::video::segment_duration },
+                            { "segment-size", recording::video::segment_size },
+                            { "timelapse", recording::video::timelapse },
+                            {
+                                "proxy",
+                                {
+                                    { "enabled", recording::video::proxy::enabled },
+                                    { "crf", recording::video::proxy::crf },
+                                },
+                            },
+                            {
+                                "replay",
+                                {
+                                    { "duration", recording::video::replay::duration },
+                                    { "size", recording::video::replay::size },
+                                },
+                            },
                             {
                                 "v",
                                 {
@@ -184,6 +236,8 @@ namespace config
                                     { "pixel-format", recording::video::v::pix_fmt },
                                     { "color-space", recording::video::v::color_space },
                                     { "color-range", recording::video::v::color_range },
+                                    { "adaptive-quality", recording::video::v::adaptive_quality },
+                                    { "backpressure", recording::video::v::backpressure },
                                 },
                             },
                             {
@@ -192,6 +246,9 @@ namespace config
                                     { "codec", recording::video::a::codec },
                                     { "channels", recording::video::a::channels },
                                     { "sample-rate", recording::video::a::sample_rate },
+                                    { "separate-tracks", recording::video::a::separate_tracks },
+                                    { "backpressure", recording::video::a::backpressure },
+                                    { "queue-limit", recording::video::a::queue_limit },
                                 },
                             },
                         },
@@ -219,6 +276,12 @@ namespace config
                     },
                 },
             },
+            {
+                "player",
+                {
+                    { "filter-threads", player::filter_threads },
+                },
+            },
         };
     }
 } // namespace config
@@ -13,6 +13,9 @@ namespace config
     inline std::string theme{ "auto" }; // auto, dark, light
     inline QString     filepath{};
 
+    // the latency profile of the audio capturers & renderers: ultra-low, normal, power-saving
+    inline std::string audio_latency{ "normal" };
+
     namespace hotkeys
     {
         inline QKeySequence screenshot{ "F1" };
@@ -22,6 +25,7 @@ namespace config
         inline QKeySequence quick_look{ "F2" };
         inline QKeySequence record_video{ "Ctrl+Alt+V" };
         inline QKeySequence record_gif{ "Ctrl+Alt+G" };
+        inline QKeySequence save_replay{ "Ctrl+Alt+R" };
         inline QKeySequence transparent_input{ "Ctrl+T" };
     } // namespace hotkeys
 
@@ -33,6 +37,9 @@ namespace config
 
     namespace recording
     {
+        // slice threads of the video filters, 0: a share of the cores left by the encoder
+        inline int filter_threads{ 0 };
+
         namespace video
         {
             inline SelectorStyle style{ 2, "#ffff5500", Qt::SolidLine, "#88000000" };
@@ -46,6 +53,37 @@ namespace config
             inline bool mic_enabled{ false };
             inline bool speaker_enabled{ true };
 
+            // record a lossless intermediate with a cheap codec, and transcode it to the codec and preset
+            // below in the background after the recording
+            inline bool transcode{ false };
+            // the video segments transcoded in parallel, 0: auto
+            inline int  transcode_jobs{ 0 };
+
+            // fragmented MP4 / live Matroska, seconds: playable up to the last fragment after a crash
+            inline int fragment_duration{ 0 }; // 0: disabled
+
+            // rotation: a new file is started after the minutes or MiB, 0: disabled
+            inline int segment_duration{ 0 };
+            inline int segment_size{ 0 };
+
+            // time-lapse: ms between the captured frames, which are played at the frame rate without audio,
+            // 0: disabled
+            inline int timelapse{ 0 };
+
+            // a lower bitrate copy of the recording, <name>.proxy.<ext>, encoded from the same frames
+            namespace proxy
+            {
+                inline bool enabled{ false };
+                inline int  crf{ 35 };
+            } // namespace proxy
+
+            // instant replay: keep the last seconds in memory and save them by the hotkey
+            namespace replay
+            {
+                inline int duration{ 0 }; // seconds, 0: disabled
+                inline int size{ 512 };   // MiB
+            } // namespace replay
+
             namespace v
             {
                 inline std::string   codec{ "libx264" };
@@ -65,6 +103,10 @@ namespace config
                 inline AVPixelFormat pix_fmt{ AV_PIX_FMT_YUV420P };
                 inline AVColorSpace  color_space{ AVCOL_SPC_BT709 };
                 inline AVColorRange  color_range{ AVCOL_RANGE_MPEG };
+                // raise the crf and encode fewer frames when the encoder falls behind, opt-in
+                inline bool          adaptive_quality{ false };
+                // when the encoder falls behind: block, drop-oldest, drop-newest, elastic
+                inline std::string   backpressure{ "drop-oldest" };
             } // namespace v
 
             namespace a
@@ -73,6 +115,12 @@ namespace config
                 // options
                 inline int         channels{ 2 };
                 inline int         sample_rate{ 48000 };
+                // a track for each source instead of mixing them
+                inline bool        separate_tracks{ false };
+                // when the encoder falls behind: block, drop-oldest, drop-newest, elastic
+                inline std::string backpressure{ "elastic" };
+                // elastic: the queue grows up to the frames before the oldest one is dropped
+                inline int         queue_limit{ 1024 };
             } // namespace a
         } // namespace video
 
@@ -91,6 +139,12 @@ namespace config
         } // namespace gif
     } // namespace recording
 
+    namespace player
+    {
+        // threads of the filter graphs, 0: auto
+        inline int filter_threads{ 0 };
+    } // namespace player
+
     namespace devices
     {
         inline std::string mic{};
@@ -3,7 +3,7 @@
 
 #include "framelesswindow.h"
 #include "libcap/producer.h"
-#include "libcap/queue.h"
+#include "libcap/spsc-queue.h"
 #include "texture-widget-rhi.h"
 
 class QMenu;
@@ -41,7 +41,7 @@ private:
     // video
     std::jthread                         thread_{};
     std::unique_ptr<Producer<av::frame>> source_{};
-    safe_queue<av::frame>                vbuffer_{ 4 };
+    spsc_queue<av::frame>                vbuffer_{ 4 };
 };
 
 #endif // !CAPTURER_VIDEO_PLAYER_H
\ No newline at end of file
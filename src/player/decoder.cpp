@@ -521,6 +521,8 @@ int Decoder::create_video_graph(const AVBufferRef *frames_ctx)
     if (vctx_.graph) avfilter_graph_free(&vctx_.graph);
     if (vctx_.graph = avfilter_graph_alloc(); !vctx_.graph) return av::NOMEM;
 
+    av::graph::set_threads(vctx_.graph, filter_threads_);
+
     if (av::graph::create_video_src(vctx_.graph, &vctx_.src, vfi, frames_ctx) < 0) return -1;
     if (av::graph::create_video_sink(vctx_.graph, &vctx_.sink, vfo, av::texture_formats()) < 0) return -1;
 
@@ -100,6 +100,9 @@ public:
 
     int set_hwaccel(AVHWDeviceType, AVPixelFormat);
 
+    // slice threads of the video filter graph, 0 for the default
+    void set_filter_threads(int threads) { filter_threads_ = threads; }
+
 private:
     int open_video_stream(int index);
     int open_audio_stream(int index);
@@ -139,6 +142,8 @@ private:
     std::atomic<AVHWDeviceType> hwaccel_{ AV_HWDEVICE_TYPE_NONE };
     std::atomic<AVPixelFormat>  hw_pix_fmt_{ AV_PIX_FMT_D3D11 };
 
+    int filter_threads_{};
+
     // subtitles
     std::atomic<int> sub_type_{}; // text or bitmap based
 
@@ -1,5 +1,6 @@
 #include "video-player.h"
 
+#include "config.h"
 #include "libcap/devices.h"
 #include "libcap/sonic.h"
 #include "logging.h"
@@ -140,6 +141,7 @@ int VideoPlayer::open(const std::string& filename)
 #ifdef _WIN32
     if (control_->hwdecoded()) source_->set_hwaccel(AV_HWDEVICE_TYPE_D3D11VA, AV_PIX_FMT_D3D11);
 #endif
+    source_->set_filter_threads(config::player::filter_threads);
     if (source_->open(filename) != 0) {
         source_ = std::make_unique<Decoder>();
         loge("[    PLAYER] failed to open video decoder");
@@ -159,6 +161,8 @@ int VideoPlayer::open(const std::string& filename)
     if (source_->has(AVMEDIA_TYPE_AUDIO)) {
         audio_enabled_ = true;
 
+        audio_renderer_->latency = config::audio_latency;
+
         if (const auto default_asink = av::default_audio_sink();
             !default_asink ||
             audio_renderer_->open(default_asink->id, AudioRenderer::RENDER_ALLOW_STREAM_SWITCH) != 0) {
@@ -332,8 +336,10 @@ uint32_t VideoPlayer::audio_callback(uint8_t **ptr, const uint32_t request_frame
     //                                               |
     //                                           audio pts
     if (audio_pts_.load() != av::clock::nopts) {
-        const uint32_t N = sonic_stream_expected_samples(sonic_stream_);    // sonic
-        const uint32_t M = audio_renderer_->buffer_size() - request_frames; // renderer
+        // the request may be larger than the buffer of the renderer, e.g. with the ultra-low latency
+        const uint32_t buffered = audio_renderer_->buffer_size();
+        const uint32_t N        = sonic_stream_expected_samples(sonic_stream_);              // sonic
+        const uint32_t M        = buffered > request_frames ? buffered - request_frames : 0; // renderer
         timeline_.set(audio_pts_.load() - av::clock::ns(N + M, source_->afo.time_base) * timeline_.speed(),
                       ts);
     }
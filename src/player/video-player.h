@@ -6,6 +6,7 @@
 #include "framelesswindow.h"
 #include "libcap/audio-renderer.h"
 #include "libcap/sonic.h"
+#include "libcap/spsc-queue.h"
 #include "libcap/timeline.h"
 #include "menu.h"
 #include "texture-widget-rhi.h"
@@ -107,9 +108,9 @@ private:
     sonic_stream *sonic_stream_{}; // audio speed up / down
 
     std::atomic<bool>     seeking_{};
-    safe_queue<av::frame> aqueue_{ 2 };
+    spsc_queue<av::frame> aqueue_{ 2 };
     std::atomic<bool>     adone_{};
-    safe_queue<av::frame> vqueue_{ 2 };
+    spsc_queue<av::frame> vqueue_{ 2 };
     std::atomic<bool>     vdone_{};
 
     std::atomic<bool> subtitles_enabled_{ true };
@@ -172,6 +172,7 @@ QWidget *SettingWindow::setupHotkeyWidget()
         updateHotkey(tr("Transparent Input"), config::hotkeys::transparent_input);
         updateHotkey(tr("Video Recording"), config::hotkeys::record_video);
         updateHotkey(tr("Gif Recording"), config::hotkeys::record_gif);
+        updateHotkey(tr("Save Replay"), config::hotkeys::save_replay);
     }
 
     page->addSpacer();
@@ -364,6 +365,12 @@ QWidget *SettingWindow::setupRecordWidget()
                 [&](auto w) { config::recording::video::v::crf = w; });
         form->addRow("CRF/CQ", crf);
 
+        const auto adaptive = new QCheckBox();
+        adaptive->setChecked(config::recording::video::v::adaptive_quality);
+        connect(adaptive, &QCheckBox::toggled,
+                [](auto checked) { config::recording::video::v::adaptive_quality = checked; });
+        form->addRow(tr("Adaptive Quality"), adaptive);
+
         const auto preset = new ComboBox();
         preset
             ->add({
@@ -482,6 +489,29 @@ QWidget *SettingWindow::setupRecordWidget()
         form->addRow(tr("Sample Rate"), srate);
     }
 
+    {
+        const auto form = page->addForm(tr("Instant Replay"));
+
+        const auto duration = new QSpinBox();
+        duration->setRange(0, 600);
+        duration->setSuffix(" s");
+        duration->setSpecialValueText(tr("Disabled"));
+        duration->setContextMenuPolicy(Qt::NoContextMenu);
+        duration->setValue(config::recording::video::replay::duration);
+        connect(duration, QOverload<int>::of(&QSpinBox::valueChanged),
+                [](auto value) { config::recording::video::replay::duration = value; });
+        form->addRow(LABEL(tr("Duration"), 175), duration);
+
+        const auto size = new QSpinBox();
+        size->setRange(16, 4096);
+        size->setSuffix(" MiB");
+        size->setContextMenuPolicy(Qt::NoContextMenu);
+        size->setValue(config::recording::video::replay::size);
+        connect(size, QOverload<int>::of(&QSpinBox::valueChanged),
+                [](auto value) { config::recording::video::replay::size = value; });
+        form->addRow(tr("Memory Limit"), size);
+    }
+
     page->addSpacer();
     return page;
 }
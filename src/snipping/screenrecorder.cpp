@@ -9,10 +9,12 @@
 #include "platforms/window-effect.h"
 
 #include <fmt/core.h>
+#include <QApplication>
 #include <QDateTime>
 #include <QMouseEvent>
 #include <QStandardPaths>
 #include <QTimer>
+#include <thread>
 
 #if _WIN32
 
@@ -130,13 +132,41 @@ void ScreenRecorder::start()
 
     filename_ = "Capturer_" + QDateTime::currentDateTime().toString("yyyy-MM-dd_hhmmss_zzz").toStdString();
     if (rec_type_ == VIDEO) {
-        pix_fmt_                  = config::recording::video::v::pix_fmt;
-        codec_name_               = config::recording::video::v::codec;
-        filters_                  = "";
-        encoder_options_["vsync"] = av::to_string(av::vsync_t::cfr);
+        pix_fmt_                             = config::recording::video::v::pix_fmt;
+        codec_name_                          = config::recording::video::v::codec;
+        filters_                             = "";
+        encoder_options_["vsync"]            = av::to_string(av::vsync_t::cfr);
+        encoder_options_["adaptive_quality"] = config::recording::video::v::adaptive_quality ? "1" : "0";
+
+        replay_    = config::recording::video::replay::duration > 0;
+        transcode_ = !replay_ && config::recording::video::transcode;
+        timelapse_ = config::recording::video::timelapse > 0;
+
+        // time-lapse: a frame per sample at the output frame rate, the capturer sleeps in between
+        if (timelapse_) {
+            const auto framerate = config::recording::video::v::framerate;
+            filters_             = fmt::format("setpts=N*{}/({}*TB)", framerate.den, framerate.num);
+        }
+        if (replay_) {
+            using namespace config::recording::video;
+            encoder_options_["replay_duration"] = std::to_string(replay::duration);
+            encoder_options_["replay_size"]     = std::to_string(replay::size);
+        }
+        else {
+            encoder_options_.erase("replay_duration");
+            encoder_options_.erase("replay_size");
+        }
+
+        if (const auto fragment = config::recording::video::fragment_duration; fragment > 0)
+            encoder_options_["fragment_duration"] = std::to_string(fragment);
+        else
+            encoder_options_.erase("fragment_duration");
 
-        filename_ = config::recording::video::path.toStdString() + "/" + filename_ + "." +
-                    config::recording::video::mcf.toStdString();
+        const auto basename = config::recording::video::path.toStdString() + "/" + filename_;
+
+        intermediate_   = basename + ".intermediate.mkv";
+        proxy_filename_ = basename + ".proxy." + config::recording::video::mcf.toStdString();
+        filename_       = basename + "." + config::recording::video::mcf.toStdString();
     }
     else {
         pix_fmt_    = AV_PIX_FMT_PAL8;
@@ -188,6 +218,8 @@ void ScreenRecorder::setup()
         desktop_src_->draw_cursor    = config::recording::video::capture_mouse;
         desktop_src_->show_region    = config::recording::video::show_region;
         encoder_->vfmt.framerate     = config::recording::video::v::framerate;
+
+        if (timelapse_) desktop_src_->vfmt.framerate = { 1'000, config::recording::video::timelapse };
         break;
     }
 
@@ -255,18 +287,20 @@ void ScreenRecorder::setup()
 
     // audio sources
     int nb_ainputs = 0;
-    if (rec_type_ == VIDEO) {
+    if (rec_type_ == VIDEO && !timelapse_) {
         mic_src_     = std::make_unique<AudioCapturer>();
         speaker_src_ = std::make_unique<AudioCapturer>();
 
-        if (mic_src_->open(config::devices::mic, {}) >= 0) {
+        const std::map<std::string, std::string> aoptions{ { "latency", config::audio_latency } };
+
+        if (mic_src_->open(config::devices::mic, aoptions) >= 0) {
             menu_->disable_mic(false);
             mic_src_->mute(m_mute_);
             dispatcher_->add_input(mic_src_.get());
             nb_ainputs++;
         }
 
-        if (speaker_src_->open(config::devices::speaker, {}) >= 0) {
+        if (speaker_src_->open(config::devices::speaker, aoptions) >= 0) {
             menu_->disable_speaker(false);
             speaker_src_->mute(s_mute_);
             dispatcher_->add_input(speaker_src_.get());
@@ -274,9 +308,12 @@ void ScreenRecorder::setup()
         }
     }
 
+    // the cheap intermediate codec, in software, instead of the final one
+    const auto vcodec_name = transcode_ ? std::string{ "libx264" } : codec_name_;
+
     // set hwaccel & pixel format if any
     auto [pix_fmt, hwaccel] =
-        set_pix_fmt(desktop_src_, encoder_, avcodec_find_encoder_by_name(codec_name_.c_str()));
+        set_pix_fmt(desktop_src_, encoder_, avcodec_find_encoder_by_name(vcodec_name.c_str()));
 
     if (hwaccel != AV_HWDEVICE_TYPE_NONE) {
         pix_fmt_ = pix_fmt;
@@ -287,7 +324,7 @@ void ScreenRecorder::setup()
         encoder_->vfmt.color.space = config::recording::video::v::color_space;
         encoder_->vfmt.color.range = config::recording::video::v::color_range;
     }
-    encoder_->afmt.sample_fmt  = AV_SAMPLE_FMT_FLTP;
+    encoder_->afmt.sample_fmt  = transcode_ ? AV_SAMPLE_FMT_S16 : AV_SAMPLE_FMT_FLTP; // FLAC
     encoder_->afmt.ch_layout   = av::default_channel_layout(config::recording::video::a::channels);
     encoder_->afmt.sample_rate = config::recording::video::a::sample_rate;
     encoder_->vfmt.hwaccel     = hwaccel;
@@ -295,10 +332,31 @@ void ScreenRecorder::setup()
     // outputs
     dispatcher_->set_output(encoder_.get());
 
+    // the proxy shares the filtered frames by reference, not for the intermediate or the replay buffer
+    if (rec_type_ == VIDEO && !transcode_ && !replay_ && config::recording::video::proxy::enabled) {
+        proxy_                 = std::make_unique<Encoder>();
+        proxy_->vfmt.framerate = encoder_->vfmt.framerate;
+        proxy_->vfmt.hwaccel   = hwaccel;
+        proxy_->afmt           = encoder_->afmt;
+
+        dispatcher_->add_output(proxy_.get());
+    }
+
     // dispatcher
     dispatcher_->set_hwaccel(hwaccel);
+    dispatcher_->set_filter_threads(config::recording::filter_threads);
+    // never stall the capture threads by default: video degrades first, audio gets a larger buffer instead
+    const auto vbp = av::to_backpressure(config::recording::video::v::backpressure);
+    const auto abp = av::to_backpressure(config::recording::video::a::backpressure);
+    dispatcher_->set_backpressure(AVMEDIA_TYPE_VIDEO, vbp);
+    dispatcher_->set_backpressure(AVMEDIA_TYPE_AUDIO, abp, 64,
+                                  std::max(config::recording::video::a::queue_limit, 64));
+    // a track for each source, not for the intermediate, whose reader only decodes the first audio stream
+    const auto separate = nb_ainputs > 1 && !transcode_ && config::recording::video::a::separate_tracks;
+    dispatcher_->set_separate_audio_tracks(separate);
     // TODO: the amix may not be closed with duration=longest
-    const auto afilters = nb_ainputs > 1 ? fmt::format("amix=inputs={}:duration=first", nb_ainputs) : "";
+    const auto afilters =
+        (nb_ainputs > 1 && !separate) ? fmt::format("amix=inputs={}:duration=first", nb_ainputs) : "";
     if (dispatcher_->initialize(filters_, afilters) < 0) {
         loge("create filters failed");
         Message::error(tr("Failed to initialize the recorder"));
@@ -313,13 +371,46 @@ void ScreenRecorder::setup()
     encoder_options_["profile"] = config::recording::video::v::profile;
     encoder_options_["tune"]    = config::recording::video::v::tune;
 
-    if (encoder_->open(filename_, encoder_options_) < 0) {
+    auto options = encoder_options_;
+    if (transcode_) {
+        // lossless, x264 with qp 0 costs about as much as the capture itself
+        options["vcodec"]  = vcodec_name;
+        options["crf"]     = "0";
+        options["preset"]  = "ultrafast";
+        options["profile"] = "";
+        options["tune"]    = "";
+        options["acodec"]  = "flac";
+    }
+    else if (rec_type_ == VIDEO && !replay_) {
+        // rotation, the segments are named like the first file
+        using namespace config::recording::video;
+        if (segment_duration > 0) options["segment_duration"] = std::to_string(segment_duration * 60);
+        if (segment_size > 0) options["segment_size"] = std::to_string(segment_size);
+        options["segment_prefix"] = "Capturer_";
+    }
+
+    if (encoder_->open(transcode_ ? intermediate_ : filename_, options) < 0) {
         loge("open encoder failed");
         Message::error(tr("Could not open the encoder"));
         stop();
         return;
     }
 
+    if (proxy_) {
+        auto proxy_options                = encoder_options_;
+        proxy_options["crf"]              = std::to_string(config::recording::video::proxy::crf);
+        proxy_options["adaptive_quality"] = "0";
+        // the presets of the hardware encoders are named differently
+        if (codec_name_ == "libx264" || codec_name_ == "libx265") proxy_options["preset"] = "veryfast";
+
+        if (proxy_->open(proxy_filename_, proxy_options) < 0) {
+            loge("open the proxy encoder failed");
+            Message::error(tr("Could not open the encoder"));
+            stop();
+            return;
+        }
+    }
+
     // start
     if (dispatcher_->start()) {
         logw("RECORDING!! Please exit first.");
@@ -343,17 +434,75 @@ void ScreenRecorder::stop()
     speaker_src_ = {};
     desktop_src_ = {};
     encoder_     = {};
+    proxy_       = {};
 
     if (timer_->isActive()) {
-        emit saved(QString::fromStdString(filename_));
+        if (transcode_) {
+            av::vformat_t vfmt{};
+            vfmt.pix_fmt     = pix_fmt_;
+            vfmt.framerate   = config::recording::video::v::framerate;
+            vfmt.color.space = config::recording::video::v::color_space;
+            vfmt.color.range = config::recording::video::v::color_range;
+
+            av::aformat_t afmt{};
+            afmt.sample_fmt  = AV_SAMPLE_FMT_FLTP;
+            afmt.ch_layout   = av::default_channel_layout(config::recording::video::a::channels);
+            afmt.sample_rate = config::recording::video::a::sample_rate;
+
+            // auto: a job per 8 cores, the encoders of x264 / x265 scale well up to about 8 threads
+            auto jobs = config::recording::video::transcode_jobs;
+            if (jobs <= 0) jobs = std::max<int>(std::thread::hardware_concurrency() / 8, 1);
+
+            // outlives the recorder
+            const auto transcoder =
+                new Transcoder(intermediate_, filename_, vfmt, afmt, encoder_options_, jobs, qApp);
+            emit transcoding(transcoder);
+            transcoder->start();
+        }
+        else if (!replay_) {
+            emit saved(QString::fromStdString(filename_));
+        }
         timer_->stop();
     }
 
     recording_ = false;
+    replay_    = false;
+    transcode_ = false;
 
     QWidget::close();
 }
 
+void ScreenRecorder::saveReplay()
+{
+    const auto encoder = dynamic_cast<Encoder *>(encoder_.get());
+    if (!replay_ || !encoder || !encoder->replaying()) return;
+
+    const auto datetime = QDateTime::currentDateTime().toString("yyyy-MM-dd_hhmmss_zzz").toStdString();
+    const auto filename = config::recording::video::path.toStdString() + "/Capturer_replay_" + datetime +
+                          "." + config::recording::video::mcf.toStdString();
+
+    // reported once the file is complete, the replay is muxed in the background
+    const auto done = [this, filename](const int ret) {
+        if (ret >= 0) {
+            emit saved(QString::fromStdString(filename));
+            return;
+        }
+
+        logw("[RECORDER] failed to save the replay: {}", filename);
+        QMetaObject::invokeMethod(
+            this, [this] { Message::error(tr("Failed to save the replay")); }, Qt::QueuedConnection);
+    };
+
+    if (const auto ret = encoder->save_replay(filename, done); ret == av::AGAIN) {
+        // still saving the previous one, or nothing buffered yet
+        Message::warning(tr("The replay is not ready to be saved"));
+    }
+    else if (ret < 0) {
+        logw("[RECORDER] failed to save the replay: {}", filename);
+        Message::error(tr("Failed to save the replay"));
+    }
+}
+
 void ScreenRecorder::keyPressEvent(QKeyEvent *event)
 {
     if (event->key() == Qt::Key_Escape) {
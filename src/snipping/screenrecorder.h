@@ -6,6 +6,7 @@
 #include "libcap/screen-capturer.h"
 #include "menu/recording-menu.h"
 #include "selector.h"
+#include "transcoder.h"
 
 class QTimer;
 
@@ -26,6 +27,9 @@ public:
 signals:
     void saved(const QString& path);
 
+    // the lossless intermediate is being transcoded to the final file in the background
+    void transcoding(Transcoder *transcoder);
+
 public slots:
     void start();
     void record();
@@ -33,6 +37,9 @@ public slots:
 
     void mute(int type, bool v);
 
+    // instant replay: save the buffered packets to a new file, the recording goes on
+    void saveReplay();
+
     void setStyle(const SelectorStyle& style);
 
 private:
@@ -55,6 +62,19 @@ private:
     // filename
     std::string filename_{};
 
+    // only keep the last seconds in memory, see config::recording::video::replay
+    bool replay_{ false };
+
+    // a lower bitrate copy, see config::recording::video::proxy
+    std::string proxy_filename_{};
+
+    // record to a lossless intermediate first, see config::recording::video::transcode
+    bool        transcode_{ false };
+    std::string intermediate_{};
+
+    // sample the screen at an interval, see config::recording::video::timelapse
+    bool timelapse_{ false };
+
     // recording menu
     RecordingMenu *menu_{};
     bool           m_mute_{};
@@ -68,8 +88,9 @@ private:
     // dispatcher
     std::unique_ptr<Dispatcher> dispatcher_{};
 
-    // sink
+    // sinks
     std::unique_ptr<Consumer<av::frame>> encoder_{};
+    std::unique_ptr<Consumer<av::frame>> proxy_{}; // a secondary output of the dispatcher
 
     // timer for displaying time on recording menu
     QTimer *timer_{ nullptr };
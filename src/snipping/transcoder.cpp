@@ -0,0 +1,132 @@
+#include "transcoder.h"
+
+#include "libcap/dispatcher.h"
+#include "libcap/encoder.h"
+#include "libcap/media-reader.h"
+#include "libcap/priority.h"
+#include "logging.h"
+
+#include <filesystem>
+#include <fmt/chrono.h>
+
+Transcoder::Transcoder(std::string input, std::string output, const av::vformat_t& vfmt,
+                       const av::aformat_t& afmt, std::map<std::string, std::string> options,
+                       const int jobs, QObject *parent)
+    : QObject(parent),
+      input_(std::move(input)),
+      output_(std::move(output)),
+      vfmt_(vfmt),
+      afmt_(afmt),
+      options_(std::move(options)),
+      jobs_(std::max(jobs, 1))
+{
+    // the threads of the pipelines run at a lower priority, never the UI or a live recording
+    options_["background"] = "true";
+
+    if (jobs_ > 1) chunked_ = std::make_unique<ChunkedEncoder>(jobs_);
+
+    connect(this, &Transcoder::finished, this, &QObject::deleteLater, Qt::QueuedConnection);
+}
+
+void Transcoder::start()
+{
+    thread_ = std::jthread([this] {
+        probe::thread::set_name("TRANSCODER");
+
+        av::lower_thread_priority();
+
+        const auto ok = (jobs_ > 1) ? run_chunked() : run();
+
+        std::error_code ec{};
+        std::filesystem::remove(ok ? input_ : output_, ec);
+        if (ec) logw("[TRANSCODER] failed to remove '{}': {}", ok ? input_ : output_, ec.message());
+
+        emit finished(QString::fromStdString(ok ? output_ : input_), ok);
+    });
+}
+
+bool Transcoder::run()
+{
+    const auto t0 = av::clock::ns();
+
+    // destroyed in the reverse order, the dispatcher first
+    MediaReader reader{};
+    Encoder     encoder{};
+    Dispatcher  dispatcher{};
+
+    if (reader.open(input_, { { "background", "true" } }) < 0) return false;
+
+    dispatcher.set_offline(true);
+    dispatcher.set_background(true);
+    if (dispatcher.add_input(&reader) < 0) return false;
+
+    encoder.vfmt.pix_fmt   = vfmt_.pix_fmt;
+    encoder.vfmt.color     = vfmt_.color;
+    encoder.vfmt.framerate = vfmt_.framerate;
+    encoder.afmt           = afmt_;
+
+    dispatcher.set_output(&encoder);
+
+    if (dispatcher.initialize({}, {}) < 0) {
+        loge("[TRANSCODER] failed to initialize the dispatcher");
+        return false;
+    }
+
+    auto options       = options_;
+    options["offline"] = "true";
+    if (encoder.open(output_, options) < 0) {
+        loge("[TRANSCODER] failed to open the encoder");
+        return false;
+    }
+
+    if (dispatcher.start() < 0) return false;
+
+    logi("[TRANSCODER] '{}' >>> '{}'", input_, output_);
+
+    const auto duration = reader.duration();
+
+    int percent = -1;
+    while (!encoder.eof() && dispatcher.running() && !cancelled_) {
+        std::this_thread::sleep_for(100ms);
+
+        if (duration > 0ns) {
+            const auto position = dispatcher.escaped() - std::max(reader.start_time(), 0ns);
+            const auto p        = static_cast<int>(std::clamp<int64_t>(position * 100 / duration, 0, 100));
+            if (p != percent) emit progress(percent = p);
+        }
+    }
+
+    const auto ok = encoder.eof() && !cancelled_;
+
+    dispatcher.stop();
+
+    logi("[TRANSCODER] {}, {:%T} in {:%T}", ok ? "DONE" : "FAILED", duration, av::clock::ns() - t0);
+
+    return ok;
+}
+
+bool Transcoder::run_chunked()
+{
+    logi("[TRANSCODER] '{}' >>> '{}', {} jobs", input_, output_, jobs_);
+
+    int percent = -1;
+    chunked_->onprogress = [&](const double p) {
+        if (static_cast<int>(p * 100) != percent) emit progress(percent = static_cast<int>(p * 100));
+    };
+
+    return chunked_->run(input_, output_, vfmt_, afmt_, options_) >= 0 && !cancelled_;
+}
+
+void Transcoder::cancel()
+{
+    cancelled_ = true;
+
+    if (chunked_) chunked_->cancel();
+}
+
+Transcoder::~Transcoder()
+{
+    cancel();
+
+    if (thread_.joinable()) thread_.join();
+}
@@ -0,0 +1,55 @@
+#ifndef CAPTURER_TRANSCODER_H
+#define CAPTURER_TRANSCODER_H
+
+#include "libcap/chunked-encoder.h"
+#include "libcap/media.h"
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <QObject>
+#include <thread>
+
+// Transcodes a recording to the final codec in the background, e.g. the lossless intermediate of
+// ScreenRecorder, by an offline dispatcher on a low priority thread. The input is deleted on success,
+// the partial output on failure. Deletes itself once finished.
+// With more than 1 job, the video is split into segments encoded in parallel, see ChunkedEncoder.
+class Transcoder final : public QObject
+{
+    Q_OBJECT
+
+public:
+    // vfmt / afmt: the pixel format, color and frame rate / the sample format and layout of the output
+    // jobs: the video segments encoded in parallel, 1 to encode the file in one piece
+    Transcoder(std::string input, std::string output, const av::vformat_t& vfmt, const av::aformat_t& afmt,
+               std::map<std::string, std::string> options, int jobs = 1, QObject *parent = nullptr);
+
+    ~Transcoder() override;
+
+    void start();
+
+    void cancel();
+
+    [[nodiscard]] QString output() const { return QString::fromStdString(output_); }
+
+signals:
+    void progress(int percent);
+    void finished(const QString& path, bool ok);
+
+private:
+    bool run();
+    bool run_chunked();
+
+    std::string                        input_{};
+    std::string                        output_{};
+    av::vformat_t                      vfmt_{};
+    av::aformat_t                      afmt_{};
+    std::map<std::string, std::string> options_{};
+    int                                jobs_{ 1 };
+
+    std::atomic<bool>               cancelled_{};
+    std::unique_ptr<ChunkedEncoder> chunked_{};
+    std::jthread      thread_{};
+};
+
+#endif //! CAPTURER_TRANSCODER_H
@@ -0,0 +1,107 @@
+// the SIMD versions of blend::argb_over() must be bit-exact with the scalar one
+
+#include "libcap/blend.h"
+
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+
+struct image_t
+{
+    int                   w{};
+    int                   h{};
+    std::vector<uint32_t> src{}; // premultiplied ARGB32
+    std::vector<uint8_t>  dst{}; // BGR0
+};
+
+// premultiplied, with the alpha values that take the special paths and the ones around them
+static image_t generate(std::mt19937& rng, const int w, const int h, const bool edges)
+{
+    static constexpr std::array<uint8_t, 8> ALPHAS = { 0, 1, 2, 127, 128, 253, 254, 255 };
+
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    image_t image{ w, h, std::vector<uint32_t>(static_cast<size_t>(w) * h),
+                   std::vector<uint8_t>(static_cast<size_t>(w) * h * 4) };
+
+    for (auto& px : image.src) {
+        const auto a = static_cast<uint32_t>(edges ? ALPHAS[byte(rng) % ALPHAS.size()] : byte(rng));
+
+        const auto premultiplied = [&] { return static_cast<uint32_t>(byte(rng)) * a / 255; };
+
+        const auto r = premultiplied();
+        const auto g = premultiplied();
+        const auto b = premultiplied();
+        px           = (a << 24) | (b << 16) | (g << 8) | r;
+    }
+
+    for (auto& c : image.dst) c = static_cast<uint8_t>(byte(rng));
+
+    return image;
+}
+
+using kernel_t = void (*)(uint8_t *, int, const uint32_t *, int, int, int);
+
+static bool compare(const char *name, const kernel_t kernel, const image_t& image)
+{
+    auto expected = image.dst;
+    auto actual   = image.dst;
+
+    blend::argb_over_c(expected.data(), image.w * 4, 4, image.src.data(), image.w, image.w, image.h);
+    kernel(actual.data(), image.w * 4, image.src.data(), image.w, image.w, image.h);
+
+    if (std::memcmp(expected.data(), actual.data(), expected.size()) == 0) return true;
+
+    for (size_t i = 0; i < expected.size(); ++i) {
+        if (expected[i] != actual[i]) {
+            std::fprintf(stderr, "%s: %dx%d, mismatch at byte %zu: %d != %d\n", name, image.w, image.h, i,
+                         actual[i], expected[i]);
+            break;
+        }
+    }
+    return false;
+}
+
+int main()
+{
+    std::mt19937 rng{ 20260101 };
+
+    std::vector<std::pair<const char *, kernel_t>> kernels{};
+#if defined(__x86_64__) || defined(_M_X64)
+    kernels.emplace_back("sse2", &blend::argb_over_sse2);
+#if defined(__GNUC__) || defined(__clang__)
+    if (blend::has_avx2())
+        kernels.emplace_back("avx2", &blend::argb_over_avx2);
+    else
+        std::printf("avx2: not supported, skipped\n");
+#endif
+#endif
+
+    // the widths cover the vector bodies and the scalar tails
+    int failed = 0;
+    for (const auto& [name, kernel] : kernels) {
+        for (const auto w : { 1, 3, 4, 7, 8, 9, 15, 16, 17, 31, 64, 129 }) {
+            for (const auto edges : { false, true }) {
+                if (!compare(name, kernel, generate(rng, w, 5, edges))) ++failed;
+            }
+        }
+    }
+
+    // every alpha against every destination value, for a single channel
+    for (const auto& [name, kernel] : kernels) {
+        image_t image{ 256, 256, std::vector<uint32_t>(256 * 256), std::vector<uint8_t>(256 * 256 * 4) };
+        for (uint32_t a = 0; a < 256; ++a) {
+            for (uint32_t d = 0; d < 256; ++d) {
+                image.src[a * 256 + d] = (a << 24) | (a / 2);
+                image.dst[(a * 256 + d) * 4] = static_cast<uint8_t>(d);
+            }
+        }
+        if (!compare(name, kernel, image)) ++failed;
+    }
+
+    std::printf("%zu kernels, %d failed\n", kernels.size(), failed);
+
+    return failed ? 1 : 0;
+}
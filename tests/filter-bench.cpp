@@ -0,0 +1,162 @@
+// the filter graphs of the recorder at 1 ~ N slice threads, see av::graph::set_threads()
+//
+//  filter-bench [frames = 60] [max threads = hardware concurrency]
+//
+//  gif  : 1280x720 bgr0 -> the palette filters of the GIF recording -> pal8
+//  scale: 3840x2160 bgr0 -> scale -> 1920x1080 yuv420p, e.g. a 4K display recorded at 1080p
+
+#include "libcap/clock.h"
+#include "libcap/ffmpeg-wrapper.h"
+#include "libcap/filter.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+extern "C" {
+#include <libavfilter/buffersink.h>
+#include <libavfilter/buffersrc.h>
+}
+
+struct case_t
+{
+    const char   *name;
+    std::string   desc;
+    av::vformat_t ifmt;
+    av::vformat_t ofmt;
+};
+
+static av::vformat_t vformat(const int width, const int height, const AVPixelFormat pix_fmt)
+{
+    av::vformat_t fmt{};
+    fmt.width     = width;
+    fmt.height    = height;
+    fmt.pix_fmt   = pix_fmt;
+    fmt.framerate = { 30, 1 };
+    fmt.time_base = { 1, 30 };
+    return fmt;
+}
+
+static int create_graph(AVFilterGraph *graph, const case_t& c, AVFilterContext **src,
+                        AVFilterContext **sink)
+{
+    if (av::graph::create_video_src(graph, src, c.ifmt, nullptr) < 0) return -1;
+    if (av::graph::create_video_sink(graph, sink, c.ofmt) < 0) return -1;
+
+    AVFilterInOut *inputs = nullptr, *outputs = nullptr;
+    if (avfilter_graph_parse2(graph, c.desc.c_str(), &inputs, &outputs) < 0) return -1;
+
+    auto ret = 0;
+    if (!inputs || !outputs || avfilter_link(*src, 0, inputs->filter_ctx, inputs->pad_idx) < 0 ||
+        avfilter_link(outputs->filter_ctx, outputs->pad_idx, *sink, 0) < 0)
+        ret = -1;
+
+    avfilter_inout_free(&inputs);
+    avfilter_inout_free(&outputs);
+
+    return ret < 0 ? ret : avfilter_graph_config(graph, nullptr);
+}
+
+// a moving gradient, so that every frame needs a new palette
+static void fill(const av::frame& frame, const int n)
+{
+    for (int y = 0; y < frame->height; ++y) {
+        auto line = frame->data[0] + y * frame->linesize[0];
+        for (int x = 0; x < frame->width; ++x) {
+            line[4 * x + 0] = static_cast<uint8_t>(x + n);
+            line[4 * x + 1] = static_cast<uint8_t>(y + 2 * n);
+            line[4 * x + 2] = static_cast<uint8_t>(x ^ y);
+            line[4 * x + 3] = 0xff;
+        }
+    }
+}
+
+// ms per frame, < 0 on failure
+static double run(const case_t& c, const int threads, const int frames)
+{
+    AVFilterGraph *graph = avfilter_graph_alloc();
+    if (!graph) return -1;
+
+    av::graph::set_threads(graph, threads);
+
+    AVFilterContext *src  = nullptr;
+    AVFilterContext *sink = nullptr;
+    if (create_graph(graph, c, &src, &sink) < 0) {
+        avfilter_graph_free(&graph);
+        return -1;
+    }
+
+    av::frame input{};
+    input->width  = c.ifmt.width;
+    input->height = c.ifmt.height;
+    input->format = c.ifmt.pix_fmt;
+    if (av_frame_get_buffer(input.get(), 0) < 0) {
+        avfilter_graph_free(&graph);
+        return -1;
+    }
+
+    av::frame output{};
+    auto      elapsed = std::chrono::nanoseconds{};
+    for (int i = 0; i < frames; ++i) {
+        fill(input, i);
+        input->pts = i;
+
+        const auto t0 = av::clock::ns();
+        const auto flags = AV_BUFFERSRC_FLAG_PUSH | AV_BUFFERSRC_FLAG_KEEP_REF;
+        if (av_buffersrc_add_frame_flags(src, input.get(), flags) < 0) break;
+        while (av_buffersink_get_frame_flags(sink, output.put(), AV_BUFFERSINK_FLAG_NO_REQUEST) >= 0) {
+        }
+        elapsed += av::clock::ns() - t0;
+    }
+
+    avfilter_graph_free(&graph);
+
+    return std::chrono::duration<double, std::milli>(elapsed).count() / frames;
+}
+
+int main(const int argc, char *argv[])
+{
+    const auto frames  = argc > 1 ? std::max(std::atoi(argv[1]), 1) : 60;
+    const auto nthread = argc > 2 ? std::max(std::atoi(argv[2]), 1)
+                                  : std::max<int>(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    const case_t cases[] = {
+        {
+            "gif",
+            "[0:v] split [a][b];"
+            "[a] palettegen=stats_mode=single:max_colors=256 [p];[b][p] paletteuse=new=1",
+            vformat(1280, 720, AV_PIX_FMT_BGR0),
+            vformat(1280, 720, AV_PIX_FMT_PAL8),
+        },
+        {
+            "scale",
+            "scale=1920:1080",
+            vformat(3840, 2160, AV_PIX_FMT_BGR0),
+            vformat(1920, 1080, AV_PIX_FMT_YUV420P),
+        },
+    };
+
+    std::printf("default threads: %d\n", av::graph::default_threads());
+    std::printf("%-6s %8s %12s %8s\n", "graph", "threads", "ms/frame", "speedup");
+
+    for (const auto& c : cases) {
+        double base = 0;
+        for (int threads = 1; threads <= nthread; threads = threads < 4 ? threads + 1 : threads * 2) {
+            const auto ms = run(c, threads, frames);
+            if (ms < 0) {
+                std::fprintf(stderr, "%s: failed to create the filter graph\n", c.name);
+                return 1;
+            }
+
+            if (threads == 1) base = ms;
+
+            std::printf("%-6s %8d %12.3f %7.2fx\n", c.name, threads, ms, base / ms);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,160 @@
+// XshmCapturer with XDamage, on an X server, e.g. Xvfb:
+//  1. while nothing changes, the last frame is re-emitted instead of grabbing a new SHM image
+//  2. a damaged frame is grabbed and carries the damaged rectangles as the "damage" detection boxes
+//
+// exits with 77 (skipped) if there is no X server, or it does not support MIT-SHM or DAMAGE
+
+#include "libcap/linux-x/xshm-capturer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fmt/format.h>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavutil/detection_bbox.h>
+}
+
+using namespace std::chrono_literals;
+
+static constexpr int SKIPPED = 77;
+
+static const AVDetectionBBoxHeader *damage_of(const av::frame& frame)
+{
+    const auto sd = av_frame_get_side_data(frame.get(), AV_FRAME_DATA_DETECTION_BBOXES);
+    return sd ? reinterpret_cast<const AVDetectionBBoxHeader *>(sd->data) : nullptr;
+}
+
+// the damaged boxes of the frame cover the rectangle
+static bool covers(const AVDetectionBBoxHeader *header, const xcb_rectangle_t& rect)
+{
+    int x0 = INT32_MAX, y0 = INT32_MAX, x1 = INT32_MIN, y1 = INT32_MIN;
+    for (unsigned int i = 0; i < header->nb_bboxes; ++i) {
+        const auto bbox = av_get_detection_bbox(header, i);
+        if (std::strcmp(bbox->detect_label, "damage") != 0) return false;
+
+        x0 = std::min(x0, bbox->x);
+        y0 = std::min(y0, bbox->y);
+        x1 = std::max(x1, bbox->x + bbox->w);
+        y1 = std::max(y1, bbox->y + bbox->h);
+    }
+
+    return x0 <= rect.x && y0 <= rect.y && x1 >= rect.x + rect.width && y1 >= rect.y + rect.height;
+}
+
+int main()
+{
+    const auto display = std::getenv("DISPLAY");
+    if (!display) {
+        std::printf("no display, skipped\n");
+        return SKIPPED;
+    }
+
+    // the screen is damaged by another client
+    const auto conn = xcb_connect(nullptr, nullptr);
+    if (xcb_connection_has_error(conn)) {
+        std::printf("can not connect to '%s', skipped\n", display);
+        xcb_disconnect(conn);
+        return SKIPPED;
+    }
+    const auto root = xcb_setup_roots_iterator(xcb_get_setup(conn)).data->root;
+
+    XshmCapturer capturer{};
+    capturer.left           = 0;
+    capturer.top            = 0;
+    capturer.draw_cursor    = false;
+    capturer.vfmt.framerate = { 30, 1 };
+    capturer.vfmt.width     = 256;
+    capturer.vfmt.height    = 256;
+
+    if (capturer.open(fmt::format("{}.0", display), {}) < 0 || !capturer.track_damage) {
+        std::printf("MIT-SHM or DAMAGE is not supported, skipped\n");
+        xcb_disconnect(conn);
+        return SKIPPED;
+    }
+
+    std::mutex             mtx{};
+    std::vector<av::frame> frames{}; // the references keep the SHM buffers from being reused
+    capturer.onarrived = [&](const av::frame& frame, AVMediaType) {
+        std::lock_guard lock(mtx);
+        frames.push_back(frame);
+    };
+
+    if (capturer.start() < 0) return 1;
+
+    std::this_thread::sleep_for(500ms);
+
+    size_t idle = 0;
+    {
+        std::lock_guard lock(mtx);
+        idle = frames.size();
+    }
+
+    const xcb_rectangle_t rect{ 32, 32, 64, 64 };
+
+    const auto     gc       = xcb_generate_id(conn);
+    const uint32_t values[] = { 0x00ff00, XCB_SUBWINDOW_MODE_INCLUDE_INFERIORS };
+    xcb_create_gc(conn, gc, root, XCB_GC_FOREGROUND | XCB_GC_SUBWINDOW_MODE, values);
+    xcb_poly_fill_rectangle(conn, root, gc, 1, &rect);
+    xcb_flush(conn);
+
+    std::this_thread::sleep_for(500ms);
+
+    capturer.stop();
+
+    xcb_free_gc(conn, gc);
+    xcb_disconnect(conn);
+
+    int failed = 0;
+
+    // 1. the first frame is grabbed, the idle ones are references to it without any damage
+    if (idle < 5) {
+        std::fprintf(stderr, "only %zu frames captured in 500ms\n", idle);
+        return 1;
+    }
+
+    if (!damage_of(frames[0])) {
+        std::fprintf(stderr, "the first frame has no damage\n");
+        ++failed;
+    }
+
+    for (size_t i = 1; i < idle; ++i) {
+        if (frames[i]->buf[0]->buffer != frames[0]->buf[0]->buffer || damage_of(frames[i])) {
+            std::fprintf(stderr, "idle frame #%zu is grabbed or damaged\n", i);
+            ++failed;
+        }
+    }
+
+    // 2. a new image with the damaged rectangle, reused again afterwards
+    size_t damaged = 0;
+    for (size_t i = idle; i < frames.size(); ++i) {
+        const auto header = damage_of(frames[i]);
+        if (!header) continue;
+
+        if (frames[i]->buf[0]->buffer == frames[i - 1]->buf[0]->buffer) {
+            std::fprintf(stderr, "damaged frame #%zu is not grabbed\n", i);
+            ++failed;
+        }
+
+        if (!covers(header, rect)) {
+            std::fprintf(stderr, "damaged frame #%zu does not cover the drawn rectangle\n", i);
+            ++failed;
+        }
+
+        ++damaged;
+    }
+
+    if (damaged == 0) {
+        std::fprintf(stderr, "no damaged frame after drawing\n");
+        ++failed;
+    }
+
+    std::printf("%zu frames, %zu idle, %zu damaged, %d failed\n", frames.size(), idle, damaged, failed);
+
+    return failed ? 1 : 0;
+}